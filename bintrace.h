@@ -0,0 +1,37 @@
+/*
+ * bintrace.h - binary trace file format shared by mdriver and traceconv.
+ *
+ * A binary trace is a fixed-size header followed by num_ops fixed-width
+ * op records.  The record layout matches the driver's in-memory
+ * traceop_t, so mdriver can mmap the file and use the records in place
+ * without parsing or copying.  Files are written in host byte order;
+ * they are a local cache of the .rep text traces, not an interchange
+ * format.
+ */
+#ifndef __BINTRACE_H
+#define __BINTRACE_H
+
+#include <stdint.h>
+
+/* First 8 bytes of every binary trace ("REPBIN" + version + NUL) */
+#define BINTRACE_MAGIC "REPBIN1"
+#define BINTRACE_MAGIC_LEN 8
+
+typedef struct {
+    char magic[BINTRACE_MAGIC_LEN];
+    int32_t weight;
+    int32_t num_ids;
+    int32_t num_ops;
+    int32_t unused;        /* pad so data_bytes and the records stay aligned */
+    uint64_t data_bytes;
+} bintrace_header_t;
+
+/* One op record; must mirror the layout of traceop_t in mdriver.c */
+typedef struct {
+    int32_t type;          /* 0 = alloc, 1 = free, 2 = realloc */
+    int32_t unused;
+    int64_t index;
+    uint64_t size;
+} bintraceop_t;
+
+#endif /* __BINTRACE_H */
@@ -2,6 +2,15 @@
 #include <stdlib.h>
 #include <sys/times.h>
 #include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #include "clock.h"
 #include "fcyc.h"
@@ -90,6 +99,125 @@ static long int has_converged()
 	((1 + epsilon)*values[0] >= values[kbest-1]);
 }
 
+/*************************************************************
+ * Hardware performance counters (perf_event_open)
+ *
+ * Each timed batch resets and enables the counters, and the readings
+ * from the fastest batch are kept so they describe the same run the
+ * reported time does.  Counter setup failures are silent: machines
+ * with restricted perf_event_paranoid just report no counters.
+ ************************************************************/
+
+#define PERF_NEVENTS 4
+
+static perf_counts_t last_perf;  /* from the most recent fcyc/fsec call */
+
+#ifdef __linux__
+static int perf_fds[PERF_NEVENTS] = {-1, -1, -1, -1};
+static int perf_ready = 0;       /* 0 untried, 1 usable, -1 unavailable */
+static uint64_t perf_raw[PERF_NEVENTS];
+
+static int perf_open_one(unsigned int type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void perf_init(void)
+{
+    int i;
+    int nopen = 0;
+
+    perf_fds[0] = perf_open_one(PERF_TYPE_HW_CACHE,
+				PERF_COUNT_HW_CACHE_L1D |
+				(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+				(PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    perf_fds[1] = perf_open_one(PERF_TYPE_HARDWARE,
+				PERF_COUNT_HW_CACHE_MISSES);
+    perf_fds[2] = perf_open_one(PERF_TYPE_HARDWARE,
+				PERF_COUNT_HW_BRANCH_MISSES);
+    perf_fds[3] = perf_open_one(PERF_TYPE_HW_CACHE,
+				PERF_COUNT_HW_CACHE_DTLB |
+				(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+				(PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    for (i = 0; i < PERF_NEVENTS; i++) {
+	if (perf_fds[i] >= 0)
+	    nopen++;
+    }
+    perf_ready = nopen > 0 ? 1 : -1;
+}
+
+/* Reset and enable the counters ahead of a timed batch */
+static void perf_batch_start(void)
+{
+    int i;
+    if (perf_ready == 0)
+	perf_init();
+    if (perf_ready < 0)
+	return;
+    for (i = 0; i < PERF_NEVENTS; i++) {
+	if (perf_fds[i] >= 0) {
+	    ioctl(perf_fds[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(perf_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+    }
+}
+
+/* Disable the counters and read the raw batch totals */
+static void perf_batch_end(void)
+{
+    int i;
+    if (perf_ready < 0)
+	return;
+    for (i = 0; i < PERF_NEVENTS; i++) {
+	perf_raw[i] = 0;
+	if (perf_fds[i] >= 0) {
+	    ioctl(perf_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+	    if (read(perf_fds[i], &perf_raw[i], sizeof(perf_raw[i]))
+		!= sizeof(perf_raw[i]))
+		perf_raw[i] = 0;
+	}
+    }
+}
+
+/* Keep the readings of the current (fastest so far) batch */
+static void perf_keep_batch(long reps)
+{
+    if (perf_ready < 0) {
+	last_perf.valid = false;
+	return;
+    }
+    last_perf.valid = true;
+    last_perf.l1d_misses =
+	perf_fds[0] >= 0 ? (double) perf_raw[0] / reps : -1.0;
+    last_perf.llc_misses =
+	perf_fds[1] >= 0 ? (double) perf_raw[1] / reps : -1.0;
+    last_perf.branch_misses =
+	perf_fds[2] >= 0 ? (double) perf_raw[2] / reps : -1.0;
+    last_perf.dtlb_misses =
+	perf_fds[3] >= 0 ? (double) perf_raw[3] / reps : -1.0;
+}
+#else /* !__linux__ */
+static void perf_batch_start(void) {}
+static void perf_batch_end(void) {}
+static void perf_keep_batch(long reps) {
+    (void) reps;
+    last_perf.valid = false;
+}
+#endif
+
+void fcyc_get_perf(perf_counts_t *counts)
+{
+    *counts = last_perf;
+}
+
 /* Code to clear cache */
 
 
@@ -140,13 +268,19 @@ double fcyc(test_funct f, void *args)
     do {
 	if (clear_cache)
 	    clear();
+	perf_batch_start();
 	start_counter();
 	for (r = 0; r < reps; r++) {
 	    f(args);
 	}
 	cyc = (double) get_counter() / reps;
-	if (cyc > 0.0)
+	perf_batch_end();
+	if (cyc > 0.0) {
+	    /* counters follow the fastest batch, to match the result */
+	    if (samplecount == 0 || cyc < values[0])
+		perf_keep_batch(reps);
 	    add_sample(cyc);
+	}
     } while (!has_converged() && samplecount < maxsamples);
     result = values[0];
 #if !KEEP_VALS
@@ -181,14 +315,20 @@ double fsec(test_funct f, void *args)
     do {
 	if (clear_cache)
 	    clear();
+	perf_batch_start();
 	start_timer();
 	for (r = 0; r < reps; r++) {
 	    f(args);
 	}
 	sec = get_timer()/reps;
+	perf_batch_end();
 	//	printf(" %.3f", sec * 1e6);
-	if (sec > 0.0)
+	if (sec > 0.0) {
+	    /* counters follow the fastest batch, to match the result */
+	    if (samplecount == 0 || sec < values[0])
+		perf_keep_batch(reps);
 	    add_sample(sec);
+	}
     } while (!has_converged() && samplecount < maxsamples);
     result = values[0];
     //    printf(" --> %.3f\n", result * 1e6);
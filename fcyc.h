@@ -5,8 +5,28 @@
    Time can be measured in seconds or clock cycles.
 */
 
+#include <stdbool.h>
+
 typedef void (*test_funct)(void *);
 
+/*
+ * Hardware performance counters sampled around the timed repetitions.
+ * Values are averages per call of the test function, taken from the
+ * fastest measurement batch; an individual counter is negative if the
+ * event could not be opened, and valid is false if no counters were
+ * available at all (e.g. perf_event_open is restricted).
+ */
+typedef struct {
+    bool valid;
+    double l1d_misses;     /* L1 data cache read misses */
+    double llc_misses;     /* last-level cache misses */
+    double branch_misses;  /* mispredicted branches */
+    double dtlb_misses;    /* data TLB read misses */
+} perf_counts_t;
+
+/* Copy out the counters from the most recent fcyc/fsec call */
+void fcyc_get_perf(perf_counts_t *counts);
+
 /* Compute number of cycles used by function f on given set of parameters */
 double fcyc(test_funct f, void* args);
 
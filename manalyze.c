@@ -0,0 +1,274 @@
+/*
+ * manalyze.c - fragmentation replay analyzer.
+ *
+ * Replays .rep traces against mm.c and periodically emits a
+ * machine-readable time series of heap state on stdout, so size-class
+ * boundaries and split thresholds can be tuned against evidence
+ * instead of the single end-of-trace utilization number:
+ *
+ *   T <filename> <num_ids> <num_ops>
+ *       start of one trace's records
+ *   F <op> <heap> <live> <free> <nfree> <largest> <frag>
+ *       fragmentation snapshot after <op> ops: heap size, requested
+ *       live payload bytes, free bytes, free block count, largest
+ *       free block, and external fragmentation 1 - largest/free
+ *   H <op> <class> <count> <bytes>
+ *       free-block histogram, one line per non-empty size class,
+ *       using the allocator's own seg_list classification
+ *   M <op> <map>
+ *       heap occupancy map, one character per granule of the heap:
+ *       '.' all free, '#' all allocated, '1'..'9' tenths in between
+ *
+ * All fields are tab-separated.  Blocks parked in the tcache remain
+ * marked allocated and are counted as such: they are not reusable
+ * address space until flushed.
+ *
+ * Usage: manalyze [-i ops] [-w width] tracefile.rep ...
+ *   -i   ops between snapshots (default 1000); a final snapshot is
+ *        always emitted after the last op
+ *   -w   characters in the occupancy map (default 64; 0 disables)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define MAX_CLASSES 64
+#define MAX_MAP_WIDTH 512
+
+static int interval = 1000;
+static int map_width = 64;
+
+/* One heap snapshot, accumulated by the mm_heap_walk callback */
+typedef struct {
+    size_t free_bytes;
+    size_t free_blocks;
+    size_t largest_free;
+    size_t class_count[MAX_CLASSES];
+    size_t class_bytes[MAX_CLASSES];
+    size_t granule;                     /* heap bytes per map character */
+    size_t alloc_in[MAX_MAP_WIDTH];    /* allocated bytes per granule */
+} snap_t;
+
+/*
+ * visit - mm_heap_walk callback: tally one block into the snapshot
+ */
+static void visit(void *payload, size_t size, bool allocated, void *ctx)
+{
+    snap_t *s = ctx;
+
+    if (!allocated) {
+        size_t class = mm_size_class(size);
+        s->free_bytes += size;
+        s->free_blocks++;
+        if (size > s->largest_free)
+            s->largest_free = size;
+        if (class < MAX_CLASSES) {
+            s->class_count[class]++;
+            s->class_bytes[class] += size;
+        }
+    } else if (s->granule > 0) {
+        /* spread the block's bytes over the granules it spans */
+        size_t off = (size_t) ((char *) payload - (char *) mem_heap_lo());
+        size_t end = off + size;
+        while (off < end) {
+            size_t g = off / s->granule;
+            size_t upto = (g + 1) * s->granule;
+            if (upto > end)
+                upto = end;
+            if (g < MAX_MAP_WIDTH)
+                s->alloc_in[g] += upto - off;
+            off = upto;
+        }
+    }
+}
+
+/*
+ * emit_snapshot - walk the heap and print the F/H/M records for one
+ * sample point
+ */
+static void emit_snapshot(int op, size_t live_bytes)
+{
+    snap_t s;
+    size_t heap = mem_heapsize();
+    size_t nclasses = mm_size_class_count();
+    double frag = 0.0;
+    size_t i;
+
+    memset(&s, 0, sizeof(s));
+    if (map_width > 0 && heap > 0) {
+        s.granule = (heap + map_width - 1) / map_width;
+        if (s.granule == 0)
+            s.granule = 1;
+    }
+    mm_heap_walk(visit, &s);
+
+    if (s.free_bytes > 0)
+        frag = 1.0 - (double) s.largest_free / (double) s.free_bytes;
+    printf("F\t%d\t%zu\t%zu\t%zu\t%zu\t%zu\t%.4f\n",
+           op, heap, live_bytes, s.free_bytes, s.free_blocks,
+           s.largest_free, frag);
+
+    for (i = 0; i < nclasses && i < MAX_CLASSES; i++) {
+        if (s.class_count[i] > 0)
+            printf("H\t%d\t%zu\t%zu\t%zu\n",
+                   op, i, s.class_count[i], s.class_bytes[i]);
+    }
+
+    if (s.granule > 0) {
+        size_t width = (heap + s.granule - 1) / s.granule;
+        printf("M\t%d\t", op);
+        for (i = 0; i < width && i < MAX_MAP_WIDTH; i++) {
+            size_t span = s.granule;
+            int tenths;
+            if ((i + 1) * s.granule > heap)
+                span = heap - i * s.granule;
+            tenths = (int) (10 * s.alloc_in[i] / span);
+            if (s.alloc_in[i] == 0)
+                putchar('.');
+            else if (s.alloc_in[i] >= span)
+                putchar('#');
+            else
+                putchar('1' + (tenths > 9 ? 8 : tenths < 1 ? 0 : tenths - 1));
+        }
+        putchar('\n');
+    }
+}
+
+/*
+ * analyze - replay one trace, snapshotting every 'interval' ops
+ */
+static int analyze(const char *filename)
+{
+    FILE *in;
+    char type[64];
+    char **blocks;
+    size_t *block_sizes;
+    int iweight, num_ids, num_ops;
+    unsigned long data_bytes;
+    unsigned index;
+    unsigned long size;
+    size_t live_bytes = 0;
+    int op;
+    int ignore = 0;
+
+    if ((in = fopen(filename, "r")) == NULL) {
+        fprintf(stderr, "manalyze: could not open %s\n", filename);
+        return 1;
+    }
+
+    ignore += fscanf(in, "%d", &iweight);
+    ignore += fscanf(in, "%d", &num_ids);
+    ignore += fscanf(in, "%d", &num_ops);
+    ignore += fscanf(in, "%lu", &data_bytes);
+    if (num_ids <= 0 || num_ops <= 0) {
+        fprintf(stderr, "manalyze: bogus header in %s\n", filename);
+        fclose(in);
+        return 1;
+    }
+
+    if ((blocks = calloc(num_ids, sizeof(char *))) == NULL ||
+        (block_sizes = calloc(num_ids, sizeof(size_t))) == NULL) {
+        fprintf(stderr, "manalyze: out of memory\n");
+        fclose(in);
+        return 1;
+    }
+
+    mem_reset_brk();
+    if (!mm_init()) {
+        fprintf(stderr, "manalyze: mm_init failed\n");
+        fclose(in);
+        return 1;
+    }
+
+    printf("T\t%s\t%d\t%d\n", filename, num_ids, num_ops);
+
+    for (op = 0; op < num_ops && fscanf(in, "%63s", type) != EOF; op++) {
+        switch (type[0]) {
+        case 'a':
+            ignore += fscanf(in, "%u %lu", &index, &size);
+            if ((blocks[index] = mm_malloc(size)) == NULL) {
+                fprintf(stderr, "manalyze: mm_malloc failed at op %d\n", op);
+                return 1;
+            }
+            block_sizes[index] = size;
+            live_bytes += size;
+            break;
+        case 'r':
+            ignore += fscanf(in, "%u %lu", &index, &size);
+            if ((blocks[index] = mm_realloc(blocks[index], size)) == NULL &&
+                size != 0) {
+                fprintf(stderr, "manalyze: mm_realloc failed at op %d\n", op);
+                return 1;
+            }
+            live_bytes += size - block_sizes[index];
+            block_sizes[index] = size;
+            break;
+        case 'f':
+            ignore += fscanf(in, "%u", &index);
+            if ((int) index >= 0) {
+                mm_free(blocks[index]);
+                live_bytes -= block_sizes[index];
+                blocks[index] = NULL;
+                block_sizes[index] = 0;
+            }
+            break;
+        default:
+            fprintf(stderr, "manalyze: bogus op '%c' in %s\n",
+                    type[0], filename);
+            fclose(in);
+            return 1;
+        }
+
+        if ((op + 1) % interval == 0)
+            emit_snapshot(op + 1, live_bytes);
+    }
+    if (op % interval != 0)
+        emit_snapshot(op, live_bytes);
+
+    fclose(in);
+    free(blocks);
+    free(block_sizes);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int c, i;
+    int rc = 0;
+
+    while ((c = getopt(argc, argv, "i:w:h")) != EOF) {
+        switch (c) {
+        case 'i':
+            interval = atoi(optarg);
+            if (interval < 1)
+                interval = 1;
+            break;
+        case 'w':
+            map_width = atoi(optarg);
+            if (map_width > MAX_MAP_WIDTH)
+                map_width = MAX_MAP_WIDTH;
+            if (map_width < 0)
+                map_width = 0;
+            break;
+        default:
+            fprintf(stderr,
+                    "Usage: %s [-i ops] [-w width] tracefile.rep ...\n",
+                    argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (optind == argc) {
+        fprintf(stderr, "Usage: %s [-i ops] [-w width] tracefile.rep ...\n",
+                argv[0]);
+        return 1;
+    }
+
+    mem_init();
+    for (i = optind; i < argc; i++)
+        rc |= analyze(argv[i]);
+    return rc;
+}
@@ -7,6 +7,7 @@
  * Copyright (c) 2004-2016, R. Bryant and D. O'Hallaron, All rights
  * reserved.  May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE /* sched_setaffinity for benchmark-mode core pinning */
 #include <assert.h>
 #include <errno.h>
 #include <float.h>
@@ -20,12 +21,22 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <math.h>
+#include <stddef.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
+#include "bintrace.h"
+#include "clock.h"
 #include "mm.h"
 #include "memlib.h"
 #include "fcyc.h"
 #include "config.h"
-#include "stree.h"
 
 /**********************
  * Constants and macros
@@ -36,6 +47,11 @@
 #define HDRLINES       4          /* number of header lines in a trace file */
 #define LINENUM(i) (i+HDRLINES+1) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Threaded replay mode (-p) */
+#define THREADS_MAX 64            /* upper bound on replay threads */
+#define THREADS_TARGET_OPS 4000000 /* ops per thread per measurement; sets
+                                      how often short traces are repeated */
+
 #ifndef REF_ONLY
 #define REF_ONLY 0
 #endif
@@ -70,12 +86,22 @@ typedef struct range_t {
 } range_t;
 
 /*
- * All information about set of ranges represented as doubly-linked
- * list of ranges, plus a splay tree keyed by lo addresses
+ * All information about a set of ranges: a doubly-linked list of range
+ * records, an open-addressing hash table keyed by lo address for the
+ * exact insert/remove lookups, and a shadow bitmap over the heap (one
+ * bit per payload byte) for the overlap check.  Both operations are
+ * O(1) per op plus O(1) per payload byte, where the old splay tree
+ * made every trace op pay a log-time, pointer-chasing tree walk.
  */
 typedef struct {
     range_t *list;
-    tree_t *lo_tree;
+    range_t **slots;       /* hash table; NULL = empty, tombstone = deleted */
+    size_t nslots;         /* table capacity; always a power of two */
+    size_t nlive;          /* live entries */
+    size_t nfilled;        /* live entries plus tombstones */
+    uint64_t *shadow;      /* one bit per heap byte; NULL until first add */
+    char *shadow_base;     /* heap address covered by bit 0 */
+    size_t shadow_bytes;   /* number of heap bytes covered */
 } range_set_t;
 
 /* Characterizes a single trace operation (allocator request) */
@@ -85,6 +111,30 @@ typedef struct {
     size_t size;                        /* byte size of alloc/realloc request */
 } traceop_t;
 
+/*
+ * Binary traces (see bintrace.h) are mmap'd and their records used in
+ * place as the ops array, so the on-disk record must match traceop_t.
+ */
+_Static_assert(sizeof(bintraceop_t) == sizeof(traceop_t),
+               "bintraceop_t must match traceop_t");
+_Static_assert(offsetof(bintraceop_t, index) == offsetof(traceop_t, index),
+               "bintraceop_t must match traceop_t");
+_Static_assert(offsetof(bintraceop_t, size) == offsetof(traceop_t, size),
+               "bintraceop_t must match traceop_t");
+
+/*
+ * Per-id block state for streaming mode (-S).  Instead of three dense
+ * arrays indexed by id, only the ids with a live block get an entry in
+ * an open-addressing hash table, so driver memory tracks the number of
+ * simultaneously allocated blocks rather than the id count of the trace.
+ */
+typedef struct {
+    int id;               /* LIVE_EMPTY / LIVE_TOMBSTONE when unused */
+    char *block;          /* ptr returned by malloc/realloc */
+    size_t size;          /* corresponding payload size */
+    int rand_base;        /* index into random_data, if debug is on */
+} blockent_t;
+
 /* Holds the information for one trace file */
 typedef struct {
     char filename[MAXLINE];
@@ -96,6 +146,21 @@ typedef struct {
     char **blocks;        /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes;  /* ... and a corresponding array of payload sizes */
     int *block_rand_base; /* index into random_data, if debug is on */
+    void *bin_map;        /* mmap'd binary trace, or NULL if parsed from text */
+    size_t bin_map_len;   /* length of the mapping */
+
+    /* streaming mode (-S) state; NULL/0 otherwise */
+    FILE *fp;             /* open text trace, kept for chunked re-parsing */
+    long ops_offset;      /* file offset of the first request line */
+    traceop_t *op_buf;    /* chunk of parsed ops for text streaming */
+    int op_buf_lo;        /* op index of op_buf[0] */
+    int op_buf_n;         /* number of ops currently in op_buf */
+    int op_next;          /* replay cursor: next op index to hand out */
+    size_t win_off;       /* start of the current binary-trace window */
+    blockent_t *live;     /* live-id table replacing the dense arrays */
+    size_t live_slots;    /* capacity, always a power of two */
+    size_t live_nlive;    /* live entries */
+    size_t live_nfilled;  /* live entries plus tombstones */
 } trace_t;
 
 /*
@@ -122,6 +187,19 @@ typedef struct {
     /* defined only for the student malloc package */
     double util;       /* space utilization for this trace (always 0 for libc) */
 
+    /* hardware counters from the timed run (see fcyc.h) */
+    perf_counts_t perf;
+
+    /* benchmark mode (-B): 95% confidence interval around secs */
+    double secs_lo;
+    double secs_hi;
+
+    /* threaded replay mode (-p): aggregate over the replay threads */
+    double thr_kops;       /* aggregate Kops/s of the N-thread run */
+    double thr_base_kops;  /* 1-thread baseline through the same harness */
+    double thr_kops_min;   /* slowest single thread */
+    double thr_kops_max;   /* fastest single thread */
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
 
@@ -160,6 +238,19 @@ int verbose = REF_ONLY ? 0 : 1;  /* global flag for verbose output */
 static int errors = 0;           /* number of errs found when running student malloc */
 static bool onetime_flag = false;
 static bool tab_mode = false;     /* Print output as tab-separated fields */
+static int nworkers = 1;          /* number of worker processes (-j) */
+static bool speed_snapshot = false; /* timed reps restore the warmed-heap
+                                       snapshot instead of re-initializing */
+static int nthreads = 1;          /* threaded replay mode: threads (-p) */
+static bool remote_frees = false; /* threaded replay: each thread frees its
+                                     neighbor's blocks (-x) */
+static bool stream_mode = false;  /* -S: window ops through the trace file
+                                     and keep only live ids resident */
+static int bench_reps = 0;        /* benchmark mode: timed reps (-B); 0 = off */
+static int bench_warmup = 3;      /* benchmark mode: warmup reps (-w) */
+static char bench_compare_file[MAXLINE] = ""; /* baseline to gate against (-b) */
+static char bench_update_file[MAXLINE] = "";  /* baseline file to write (-u) */
+static double bench_margin = 0.0; /* extra slack for the gate, fraction (-m) */
 static size_t maxfill = MAXFILL;
 
 /* by default, no timeouts */
@@ -203,9 +294,16 @@ static void free_range_set(range_set_t *ranges);
 
 /* These functions implement the debugging code */
 static void init_random_data(void);
-static void check_index(const trace_t *trace, int opnum, int index);
+static void check_index(trace_t *trace, int opnum, int index);
 static void randomize_block(trace_t *trace, int index);
 
+/* These access per-id block state in either trace representation:
+   dense arrays normally, the live-id table in streaming mode (-S) */
+static char **trace_block(trace_t *trace, int index);
+static size_t *trace_block_size(trace_t *trace, int index);
+static int *trace_rand_base(trace_t *trace, int index);
+static void live_drop(trace_t *trace, int index);
+
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename);
@@ -221,6 +319,12 @@ static void eval_libc_speed(void *ptr);
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges);
 static double eval_mm_util(trace_t *trace, int tracenum);
 static void eval_mm_speed(void *ptr);
+static void bench_mm_speed(speed_t *speed_params, stats_t *stats);
+static int bench_report(int n, stats_t *stats);
+static void bench_pin_cpu(void);
+static void threads_mm_speed(stats_t *stats, const char *tracedir,
+                             char *tracefile);
+static void threads_report(int n, stats_t *stats);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
@@ -244,66 +348,161 @@ static void timeout_handler(int sig __attribute__((unused))) {
 /* Compute throughput from reference implementation */
 static double measure_ref_throughput();
 
+/*
+ * Evaluate one trace, filling in mm_stats[i].  Returns false if the
+ * caller should stop (onetime_flag was set).
+ */
+static bool run_one_test(int i, const char *tracedir, char **tracefiles,
+                         stats_t *mm_stats, speed_t *speed_params) {
+    /* initialize simulated memory system in memlib.c *
+     * start each trace with a clean system */
+    mem_init();
+    range_set_t * volatile ranges = new_range_set();
+
+
+    // NOTE: If times out, then it will reread the trace file
+
+    trace_t * volatile trace;
+    trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
+    strcpy(mm_stats[i].filename, trace->filename);
+    mm_stats[i].ops = trace->num_ops;
+
+    /* Prepare for timeout */
+    if (setjmp(timeout_jmpbuf) != 0) {
+        mm_stats[i].valid = false;
+    } else {
+        if (verbose > 1)
+            printf("Checking mm_malloc for correctness, ");
+        mm_stats[i].valid =
+            /* Do 2 tests, since may fail to reinitialize properly */
+            eval_mm_valid(trace, ranges) && eval_mm_valid(trace, ranges);
+
+        if (onetime_flag) {
+            free_trace(trace);
+            return false;
+        }
+    }
+    if (mm_stats[i].valid) {
+        if (verbose > 1)
+            printf("efficiency, ");
+        mm_stats[i].util = eval_mm_util(trace, i);
+        speed_params->trace = trace;
+        speed_params->ranges = ranges;
+        if (verbose > 1)
+            printf("and performance.\n");
+        /* Replay once to warm the heap, snapshot it, and let every
+         * timed repetition restore the snapshot in one copy instead of
+         * re-initializing and re-measuring the extend ramp */
+        eval_mm_speed(speed_params);
+        mem_snapshot();
+        mm_snapshot();
+        speed_snapshot = true;
+        if (bench_reps > 0) {
+            bench_mm_speed(speed_params, &mm_stats[i]);
+        } else {
+            mm_stats[i].secs = fsec(eval_mm_speed, speed_params);
+            fcyc_get_perf(&mm_stats[i].perf);
+        }
+        speed_snapshot = false;
+        if (nthreads > 1) {
+            if (verbose > 1)
+                printf("Threaded replay with %d threads.\n", nthreads);
+            threads_mm_speed(&mm_stats[i], tracedir, tracefiles[i]);
+        }
+    }
+
+    free_trace(trace);
+    free_range_set(ranges);
+
+    /* clean up memory system */
+    mem_deinit();
+    return true;
+}
+
 /*
  * Run the tests; return the number of tests run (may be less than
  * num_tracefiles, if there's a timeout)
  */
 static void run_tests(int num_tracefiles, const char *tracedir,
-                      char **tracefiles, 
+                      char **tracefiles,
                       stats_t *mm_stats, speed_t *speed_params) {
     volatile int i;
 
     for (i=0; i < num_tracefiles; i++) {
-        /* initialize simulated memory system in memlib.c *
-         * start each trace with a clean system */
-        mem_init();
-        range_set_t *ranges = new_range_set();
-
-
-        // NOTE: If times out, then it will reread the trace file 
+        if (!run_one_test(i, tracedir, tracefiles, mm_stats, speed_params))
+            return;
+    }
+}
 
-        trace_t *trace;
-        trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
-        strcpy(mm_stats[i].filename, trace->filename);
-        mm_stats[i].ops = trace->num_ops;
+/*
+ * run_tests_parallel - farm the traces out to nworkers child processes
+ * (selected with -j).  Traces are independent: each worker gets its own
+ * copy of the memlib heap via fork, evaluates every nworkers-th trace,
+ * and writes its stats_t results into a MAP_SHARED array that the
+ * parent copies back once all workers have exited.  Timed runs contend
+ * for cores, so expect throughput noise; -j is for correctness and
+ * utilization sweeps where turnaround matters more than clean timing.
+ */
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles, stats_t *mm_stats,
+                               speed_t *speed_params, int nworkers) {
+    size_t shared_len = num_tracefiles * sizeof(stats_t);
+    stats_t *shared;
+    pid_t *pids;
+    volatile int w;
+    int i;
 
-        /* Prepare for timeout */
-        if (setjmp(timeout_jmpbuf) != 0) {
-            mm_stats[i].valid = false;
-        } else {
-            if (verbose > 1)
-                printf("Checking mm_malloc for correctness, ");
-            mm_stats[i].valid =
-		/* Do 2 tests, since may fail to reinitialize properly */
-		eval_mm_valid(trace, ranges) && eval_mm_valid(trace, ranges);
-
-            if (onetime_flag) {
-                free_trace(trace);
-                return;
+    if (nworkers > num_tracefiles)
+        nworkers = num_tracefiles;
+
+    shared = mmap(NULL, shared_len, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+        unix_error("mmap failed in run_tests_parallel");
+    memcpy(shared, mm_stats, shared_len);
+
+    if ((pids = calloc(nworkers, sizeof(pid_t))) == NULL)
+        unix_error("calloc failed in run_tests_parallel");
+
+    for (w = 0; w < nworkers; w++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            unix_error("fork failed in run_tests_parallel");
+        if (pid == 0) {
+            /* Worker: pending alarms are not inherited, so re-arm */
+            if (set_timeout > 0) {
+                signal(SIGALRM, timeout_handler);
+                alarm(set_timeout);
             }
+            for (i = w; i < num_tracefiles; i += nworkers) {
+                if (!run_one_test(i, tracedir, tracefiles, shared,
+                                  speed_params))
+                    break;
+            }
+            _exit(errors ? 1 : 0);
         }
-        if (mm_stats[i].valid) {
-            if (verbose > 1)
-                printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
-            speed_params->trace = trace;
-            speed_params->ranges = ranges;
-            if (verbose > 1)
-                printf("and performance.\n");
-            mm_stats[i].secs = fsec(eval_mm_speed, speed_params);
-        }
-
-#if 0
-        printf(" %d operations.  %ld comparisons.  Avg = %.1f\n",
-               trace->num_ops, ranges->lo_tree->comparison_count,
-               (double) ranges->lo_tree->comparison_count / trace->num_ops);
-#endif
-        free_trace(trace);
-        free_range_set(ranges);
+        pids[w] = pid;
+    }
 
-        /* clean up memory system */
-        mem_deinit();
+    /* A timeout here kills the workers; unfinished traces stay invalid */
+    if (setjmp(timeout_jmpbuf) != 0) {
+        for (w = 0; w < nworkers; w++) {
+            if (pids[w] > 0)
+                kill(pids[w], SIGKILL);
+        }
     }
+    for (w = 0; w < nworkers; w++) {
+        int status;
+        if (pids[w] > 0 && waitpid(pids[w], &status, 0) == pids[w]) {
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                errors++;
+            pids[w] = 0;
+        }
+    }
+
+    memcpy(mm_stats, shared, shared_len);
+    munmap(shared, shared_len);
+    free(pids);
 }
 
 /**************
@@ -344,9 +543,53 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hOVAlDT")) != EOF) {
+    while ((c = getopt(argc, argv, "b:d:f:c:j:m:p:s:t:u:v:w:B:hOVAlDSTx")) != EOF) {
         switch (c) {
 
+        case 'B': /* Benchmark mode with this many timed reps per trace */
+            bench_reps = atoi(optarg);
+            if (bench_reps < 1)
+                bench_reps = 1;
+            break;
+
+        case 'w': /* Benchmark mode warmup reps */
+            bench_warmup = atoi(optarg);
+            if (bench_warmup < 0)
+                bench_warmup = 0;
+            break;
+
+        case 'b': /* Gate against this throughput baseline file */
+            strcpy(bench_compare_file, optarg);
+            break;
+
+        case 'u': /* Write measured throughputs to this baseline file */
+            strcpy(bench_update_file, optarg);
+            break;
+
+        case 'm': /* Percent slack added to the regression gate */
+            bench_margin = atof(optarg) / 100.0;
+            if (bench_margin < 0)
+                bench_margin = 0;
+            break;
+
+        case 'j': /* Evaluate traces in parallel worker processes */
+            nworkers = atoi(optarg);
+            if (nworkers < 1)
+                nworkers = 1;
+            break;
+
+        case 'p': /* Threaded replay with this many concurrent threads */
+            nthreads = atoi(optarg);
+            if (nthreads < 1)
+                nthreads = 1;
+            if (nthreads > THREADS_MAX)
+                nthreads = THREADS_MAX;
+            break;
+
+        case 'x': /* Threaded replay: each thread frees its neighbor's blocks */
+            remote_frees = true;
+            break;
+
         case 'A': /* Hidden Autolab driver argument */
             autograder = true;
             break;
@@ -393,6 +636,10 @@ int main(int argc, char **argv)
             set_timeout = atoi(optarg);
             break;
 
+        case 'S': /* Stream traces through a bounded window */
+            stream_mode = true;
+            break;
+
         case 'T':
             tab_mode = true;
             break;
@@ -408,6 +655,15 @@ int main(int argc, char **argv)
     }
 #endif /* !REF_ONLY */
 
+    if (nthreads > 1 && stream_mode)
+        app_error("Streaming (-S) cannot be combined with threaded replay (-p)");
+
+    /* N concurrent trace copies need roughly N times the heap, which
+       can exceed the dense mapping: default threaded replay to the
+       sparse reservation unless the user picked a mapping explicitly */
+    if (nthreads > 1)
+        setenv("MEMLIB_SPARSE", "8192", 0);
+
     if (num_global_tracefiles == 0) {
         int i;
         for (i = 0; default_tracefiles[i]; i++)
@@ -418,6 +674,9 @@ int main(int argc, char **argv)
         init_random_data();
     }
 
+    if (bench_reps > 0)
+        bench_pin_cpu();
+
     /* Initialize the timeout */
     if (set_timeout > 0) {
         signal(SIGALRM, timeout_handler);
@@ -486,8 +745,12 @@ int main(int argc, char **argv)
     if (mm_stats == NULL)
         unix_error("mm_stats calloc in main failed");
 
-    run_tests(num_global_tracefiles, tracedir, global_tracefiles, mm_stats,
-              &speed_params);
+    if (nworkers > 1 && !onetime_flag)
+        run_tests_parallel(num_global_tracefiles, tracedir, global_tracefiles,
+                           mm_stats, &speed_params, nworkers);
+    else
+        run_tests(num_global_tracefiles, tracedir, global_tracefiles, mm_stats,
+                  &speed_params);
 
 
     /* Display the mm results in a compact table */
@@ -615,6 +878,16 @@ int main(int argc, char **argv)
                 avg_mm_throughput, avg_mm_util*100);
         printf("%s\n", autoresult);
     }
+
+    /* Benchmark mode: report intervals and gate on the baseline */
+    if (bench_reps > 0 && !onetime_flag && errors == 0) {
+        if (bench_report(num_global_tracefiles, mm_stats) > 0)
+            exit(1);
+    }
+
+    /* Threaded replay mode: report scaling against the 1-thread baseline */
+    if (nthreads > 1 && !onetime_flag && errors == 0)
+        threads_report(num_global_tracefiles, mm_stats);
     exit(0);
 }
 
@@ -636,13 +909,149 @@ static void add_tracefile(char *trace) {
  * range list to detect any overlapping allocated blocks.
  ****************************************************************/
 
+/* Sentinel marking a deleted hash slot */
+#define RANGE_TOMBSTONE ((range_t *) -1)
+
+#define RANGE_MAP_INIT_SLOTS 1024
+
+/* Fibonacci hash of a payload address (always ALIGNMENT-aligned) */
+static size_t range_hash(const char *lo)
+{
+    return (size_t) ((((uintptr_t) lo >> 4) * 0x9E3779B97F4A7C15UL) >> 32);
+}
+
+/*
+ * range_map_place - probe for lo in a slot array; returns the slot to
+ * fill for an insert (first tombstone or empty slot on the probe path)
+ */
+static range_t **range_map_place(range_t **slots, size_t nslots, char *lo)
+{
+    size_t mask = nslots - 1;
+    size_t i = range_hash(lo) & mask;
+    range_t **tombstone = NULL;
+
+    while (slots[i] != NULL) {
+        if (slots[i] == RANGE_TOMBSTONE) {
+            if (tombstone == NULL)
+                tombstone = &slots[i];
+        } else if (slots[i]->lo == lo) {
+            return &slots[i];
+        }
+        i = (i + 1) & mask;
+    }
+    return tombstone ? tombstone : &slots[i];
+}
+
+/*
+ * range_map_insert - add a range record to the hash table, growing the
+ * table (and discarding tombstones) when it passes half full
+ */
+static void range_map_insert(range_set_t *ranges, range_t *p)
+{
+    if (2 * (ranges->nfilled + 1) > ranges->nslots) {
+        size_t newslots = 2 * ranges->nslots;
+        range_t **slots = calloc(newslots, sizeof(range_t *));
+        range_t *r;
+        if (slots == NULL)
+            unix_error("calloc error in range_map_insert");
+        for (r = ranges->list; r != NULL; r = r->next)
+            *range_map_place(slots, newslots, r->lo) = r;
+        free(ranges->slots);
+        ranges->slots = slots;
+        ranges->nslots = newslots;
+        ranges->nfilled = ranges->nlive;
+    }
+
+    range_t **slot = range_map_place(ranges->slots, ranges->nslots, p->lo);
+    if (*slot == NULL)
+        ranges->nfilled++;
+    *slot = p;
+    ranges->nlive++;
+}
+
+/*
+ * range_map_remove - look up and unlink the record keyed by lo;
+ * returns NULL if no such record exists
+ */
+static range_t *range_map_remove(range_set_t *ranges, char *lo)
+{
+    size_t mask = ranges->nslots - 1;
+    size_t i = range_hash(lo) & mask;
+
+    while (ranges->slots[i] != NULL) {
+        range_t *p = ranges->slots[i];
+        if (p != RANGE_TOMBSTONE && p->lo == lo) {
+            ranges->slots[i] = RANGE_TOMBSTONE;
+            ranges->nlive--;
+            return p;
+        }
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+/*
+ * shadow_mark - test that no payload byte in [lo, hi] is already
+ * marked in the shadow bitmap, then mark them all, a word at a time.
+ * Returns false on overlap (some bits may already be set by then, but
+ * an overlap aborts the trace anyway).
+ */
+static bool shadow_mark(range_set_t *ranges, char *lo, char *hi)
+{
+    size_t s = lo - ranges->shadow_base;
+    size_t e = hi - ranges->shadow_base;
+    size_t w;
+
+    for (w = s / 64; w <= e / 64; w++) {
+        uint64_t mask = ~(uint64_t) 0;
+        if (w == s / 64)
+            mask &= ~(uint64_t) 0 << (s % 64);
+        if (w == e / 64)
+            mask &= ~(uint64_t) 0 >> (63 - e % 64);
+        if (ranges->shadow[w] & mask)
+            return false;
+        ranges->shadow[w] |= mask;
+    }
+    return true;
+}
+
+/*
+ * shadow_clear - clear the bitmap bits for payload bytes [lo, hi]
+ */
+static void shadow_clear(range_set_t *ranges, char *lo, char *hi)
+{
+    size_t s = lo - ranges->shadow_base;
+    size_t e = hi - ranges->shadow_base;
+    size_t w;
+
+    for (w = s / 64; w <= e / 64; w++) {
+        uint64_t mask = ~(uint64_t) 0;
+        if (w == s / 64)
+            mask &= ~(uint64_t) 0 << (s % 64);
+        if (w == e / 64)
+            mask &= ~(uint64_t) 0 >> (63 - e % 64);
+        ranges->shadow[w] &= ~mask;
+    }
+}
+
 /*
  * new_range_set - Create an empty range set
  */
 static range_set_t *new_range_set() {
     range_set_t *ranges = (range_set_t *) malloc(sizeof(range_set_t));
+    if (ranges == NULL)
+        unix_error("malloc error in new_range_set");
     ranges->list = NULL;
-    ranges->lo_tree = tree_new();
+    ranges->slots = calloc(RANGE_MAP_INIT_SLOTS, sizeof(range_t *));
+    if (ranges->slots == NULL)
+        unix_error("calloc error in new_range_set");
+    ranges->nslots = RANGE_MAP_INIT_SLOTS;
+    ranges->nlive = 0;
+    ranges->nfilled = 0;
+    /* the bitmap is allocated on first use, once the heap exists */
+    ranges->shadow = NULL;
+    ranges->shadow_base = NULL;
+    ranges->shadow_bytes = 0;
     return ranges;
 }
 
@@ -678,22 +1087,24 @@ static bool add_range(range_set_t *ranges, char *lo, size_t size,
        just assume the overlap will be caught by writing random bits. */
     if (debug_mode == DBG_NONE) return 1;
 
-    /* Look in the tree for the predecessor block */
-    range_t *prev = tree_find_nearest(ranges->lo_tree, (long unsigned) lo);
-    range_t *next = prev ? prev->next : NULL;
-    /* See if it overlaps previous or next blocks */
-    if (prev && lo <= prev->hi) {
-        malloc_error(trace, opnum,
-                     "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-                     lo, hi, prev->lo, prev->hi);
-        return false;
+    /* Lazily size the shadow bitmap to the heap, one bit per byte;
+       calloc commits its pages on first touch, so a multi-GB sparse
+       heap does not eagerly cost a multi-hundred-MB bitmap */
+    if (ranges->shadow == NULL) {
+        ranges->shadow_base = (char *) mem_heap_lo();
+        ranges->shadow_bytes = mem_heap_capacity();
+        ranges->shadow = calloc(ranges->shadow_bytes / 64, sizeof(uint64_t));
+        if (ranges->shadow == NULL)
+            unix_error("calloc error in add_range");
     }
-    if (next && hi >= next->lo) {
+
+    /* Mark the payload bytes, detecting any overlap as we go */
+    if (!shadow_mark(ranges, lo, hi)) {
         malloc_error(trace, opnum,
-                     "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-                     lo, hi, next->lo, next->hi);
+                     "Payload (%p:%p) overlaps another payload\n", lo, hi);
         return false;
     }
+
     /*
      * Everything looks OK, so remember the extent of this block
      * by creating a range struct and adding it the range list.
@@ -701,18 +1112,15 @@ static bool add_range(range_set_t *ranges, char *lo, size_t size,
     range_t *p;
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
         unix_error("malloc error in add_range");
-    p->prev = prev;
-    if (prev)
-        prev->next = p;
-    else
-        ranges->list = p;
-    p->next = next;
-    if (next)
-        next->prev = p;
+    p->prev = NULL;
+    p->next = ranges->list;
+    if (ranges->list)
+        ranges->list->prev = p;
+    ranges->list = p;
     p->lo = lo;
     p->hi = hi;
     p->index = index;
-    tree_insert(ranges->lo_tree, (long unsigned) lo, (void *) p);
+    range_map_insert(ranges, p);
     return true;
 }
 
@@ -721,9 +1129,10 @@ static bool add_range(range_set_t *ranges, char *lo, size_t size,
  */
 static void remove_range(range_set_t *ranges, char *lo)
 {
-    range_t *p = (range_t *) tree_remove(ranges->lo_tree, (long unsigned) lo);
+    range_t *p = range_map_remove(ranges, lo);
     if (!p)
         return;
+    shadow_clear(ranges, p->lo, p->hi);
     range_t *prev = p->prev;
     range_t *next = p->next;
     if (prev)
@@ -740,7 +1149,14 @@ static void remove_range(range_set_t *ranges, char *lo)
  */
 static void free_range_set(range_set_t *ranges)
 {
-    tree_free(ranges->lo_tree, free);
+    range_t *r = ranges->list;
+    while (r) {
+        range_t *next = r->next;
+        free(r);
+        r = next;
+    }
+    free(ranges->slots);
+    free(ranges->shadow);
     free(ranges);
 }
 
@@ -767,16 +1183,16 @@ static void randomize_block(trace_t *traces, int index) {
 
     if (debug_mode == DBG_NONE) return;
 
-    traces->block_rand_base[index] = random();
+    *trace_rand_base(traces, index) = random();
 
-    block = (randint_t*)traces->blocks[index];
-    size = traces->block_sizes[index] / sizeof(*block);
+    block = (randint_t*)*trace_block(traces, index);
+    size = *trace_block_size(traces, index) / sizeof(*block);
     if (size == 0)
         return;
     fsize = size;
     if (fsize > maxfill)
         fsize = maxfill;
-    base = traces->block_rand_base[index];
+    base = *trace_rand_base(traces, index);
 
     // NOTE: It's expensive to do this one byte at a time.
 
@@ -790,7 +1206,7 @@ static void randomize_block(trace_t *traces, int index) {
     }
 }
 
-static void check_index(const trace_t *trace, int opnum, int index) {
+static void check_index(trace_t *trace, int opnum, int index) {
     size_t size, fsize;
     size_t i;
     randint_t *block;
@@ -801,8 +1217,8 @@ static void check_index(const trace_t *trace, int opnum, int index) {
     if (index < 0) return; /* we're doing free(NULL) */
     if (debug_mode == DBG_NONE) return;
 
-    block = (randint_t*)trace->blocks[index];
-    size = trace->block_sizes[index] / sizeof(*block);
+    block = (randint_t*)*trace_block(trace, index);
+    size = *trace_block_size(trace, index) / sizeof(*block);
     if (size == 0)
         return;
     fsize = size;
@@ -811,7 +1227,7 @@ static void check_index(const trace_t *trace, int opnum, int index) {
     if (fsize > thresh)
         fsize = thresh;
 
-    base = trace->block_rand_base[index];
+    base = *trace_rand_base(trace, index);
 
     // NOTE: It's expensive to do this one byte at a time.
     for(i = 0; i < fsize; i++) {
@@ -831,6 +1247,285 @@ static void check_index(const trace_t *trace, int opnum, int index) {
  * The following routines manipulate tracefiles
  *********************************************/
 
+/**********************************************************************
+ * Streaming mode (-S).  A trace normally materializes every request
+ * up front plus three arrays indexed by id.  Production traces can
+ * hold hundreds of millions of requests, so in streaming mode the ops
+ * are windowed through the file instead -- a moving madvise window
+ * over the binary mapping, or chunked re-parsing of the text file --
+ * and per-id state lives in a hash table of live ids only.  Driver
+ * memory is then bounded by the window size plus the number of blocks
+ * that are simultaneously allocated, independent of trace length.
+ *********************************************************************/
+
+/* Sentinel ids marking empty and deleted live-table slots */
+#define LIVE_EMPTY     (-1)
+#define LIVE_TOMBSTONE (-2)
+
+#define LIVE_INIT_SLOTS 1024
+
+/* Ops parsed per refill when streaming a text trace */
+#define STREAM_CHUNK 65536
+
+/* Bytes of the binary mapping kept resident at a time (page multiple) */
+#define STREAM_WINDOW ((size_t) 4 << 20)
+
+/* Fibonacci hash of a block id */
+static size_t live_hash(int id)
+{
+    return (size_t) (((uint64_t) (uint32_t) id * 0x9E3779B97F4A7C15UL) >> 32);
+}
+
+/*
+ * live_place - probe for id in a slot array; returns the slot holding
+ * it, or the slot to fill on an insert (first tombstone or empty slot
+ * on the probe path)
+ */
+static blockent_t *live_place(blockent_t *slots, size_t nslots, int id)
+{
+    size_t mask = nslots - 1;
+    size_t i = live_hash(id) & mask;
+    blockent_t *tombstone = NULL;
+
+    while (slots[i].id != LIVE_EMPTY) {
+        if (slots[i].id == LIVE_TOMBSTONE) {
+            if (tombstone == NULL)
+                tombstone = &slots[i];
+        } else if (slots[i].id == id) {
+            return &slots[i];
+        }
+        i = (i + 1) & mask;
+    }
+    return tombstone ? tombstone : &slots[i];
+}
+
+/*
+ * live_ent - find the entry for an id, creating a zeroed one if the id
+ * is not in the table; grows the table (and discards tombstones) when
+ * it passes half full
+ */
+static blockent_t *live_ent(trace_t *trace, int index)
+{
+    blockent_t *ent;
+
+    if (2 * (trace->live_nfilled + 1) > trace->live_slots) {
+        size_t newslots = 2 * trace->live_slots;
+        blockent_t *slots = malloc(newslots * sizeof(blockent_t));
+        size_t i;
+        if (slots == NULL)
+            unix_error("malloc error in live_ent");
+        for (i = 0; i < newslots; i++)
+            slots[i].id = LIVE_EMPTY;
+        for (i = 0; i < trace->live_slots; i++) {
+            if (trace->live[i].id >= 0)
+                *live_place(slots, newslots, trace->live[i].id) =
+                    trace->live[i];
+        }
+        free(trace->live);
+        trace->live = slots;
+        trace->live_slots = newslots;
+        trace->live_nfilled = trace->live_nlive;
+    }
+
+    ent = live_place(trace->live, trace->live_slots, index);
+    if (ent->id != index) {
+        if (ent->id == LIVE_EMPTY)
+            trace->live_nfilled++;
+        ent->id = index;
+        ent->block = NULL;
+        ent->size = 0;
+        ent->rand_base = 0;
+        trace->live_nlive++;
+    }
+    return ent;
+}
+
+/*
+ * live_drop - forget an id once its block is freed, so the table only
+ * tracks the blocks that are currently allocated
+ */
+static void live_drop(trace_t *trace, int index)
+{
+    blockent_t *ent;
+
+    if (!stream_mode || index < 0)
+        return;
+    ent = live_place(trace->live, trace->live_slots, index);
+    if (ent->id == index) {
+        ent->id = LIVE_TOMBSTONE;
+        trace->live_nlive--;
+    }
+}
+
+static char **trace_block(trace_t *trace, int index)
+{
+    if (!stream_mode)
+        return &trace->blocks[index];
+    return &live_ent(trace, index)->block;
+}
+
+static size_t *trace_block_size(trace_t *trace, int index)
+{
+    if (!stream_mode)
+        return &trace->block_sizes[index];
+    return &live_ent(trace, index)->size;
+}
+
+static int *trace_rand_base(trace_t *trace, int index)
+{
+    if (!stream_mode)
+        return &trace->block_rand_base[index];
+    return &live_ent(trace, index)->rand_base;
+}
+
+/*
+ * stream_refill - parse the next chunk of request lines from the open
+ * text trace into op_buf
+ */
+static void stream_refill(trace_t *trace)
+{
+    char type[MAXLINE];
+    int index;
+    size_t size;
+    int n = 0;
+    int ignore = 0;
+
+    trace->op_buf_lo += trace->op_buf_n;
+    while (n < STREAM_CHUNK && trace->op_buf_lo + n < trace->num_ops &&
+           fscanf(trace->fp, "%s", type) != EOF) {
+        traceop_t *op = &trace->op_buf[n];
+        switch (type[0]) {
+        case 'a':
+            ignore += fscanf(trace->fp, "%u %lu", &index, &size);
+            op->type = ALLOC;
+            op->index = index;
+            op->size = size;
+            break;
+        case 'r':
+            ignore += fscanf(trace->fp, "%u %lu", &index, &size);
+            op->type = REALLOC;
+            op->index = index;
+            op->size = size;
+            break;
+        case 'f':
+            ignore += fscanf(trace->fp, "%u", &index);
+            op->type = FREE;
+            op->index = index;
+            break;
+        default:
+            app_error("Bogus type character (%c) in tracefile %s\n",
+                      type[0], trace->filename);
+        }
+        n++;
+    }
+    trace->op_buf_n = n;
+}
+
+/*
+ * trace_rewind - point the replay cursor back at the first op.  In
+ * streaming mode this also seeks the text parse position back to the
+ * first request line, or resets the binary-trace window.
+ */
+static void trace_rewind(trace_t *trace)
+{
+    trace->op_next = 0;
+    if (!stream_mode)
+        return;
+    if (trace->bin_map) {
+        trace->win_off = 0;
+    } else {
+        if (fseek(trace->fp, trace->ops_offset, SEEK_SET) != 0)
+            unix_error("fseek failed in trace_rewind");
+        trace->op_buf_lo = 0;
+        trace->op_buf_n = 0;
+    }
+}
+
+/*
+ * trace_next_op - hand out the next request, or NULL at the end of the
+ * trace.  In streaming mode at most one window of the trace is
+ * resident: text traces are parsed a chunk at a time, and for binary
+ * traces the consumed part of the mapping is released with madvise as
+ * the cursor crosses each window boundary.
+ */
+static const traceop_t *trace_next_op(trace_t *trace)
+{
+    int i = trace->op_next;
+
+    if (i >= trace->num_ops)
+        return NULL;
+    trace->op_next = i + 1;
+
+    if (stream_mode && trace->bin_map == NULL) {
+        if (i >= trace->op_buf_lo + trace->op_buf_n)
+            stream_refill(trace);
+        return &trace->op_buf[i - trace->op_buf_lo];
+    }
+    if (stream_mode) {
+        /* the header rides in the first window, so window offsets stay
+           aligned to the (page-aligned) start of the mapping */
+        size_t off = sizeof(bintrace_header_t) +
+            (size_t) i * sizeof(bintraceop_t);
+        if (off >= trace->win_off + STREAM_WINDOW) {
+            madvise((char *) trace->bin_map + trace->win_off, STREAM_WINDOW,
+                    MADV_DONTNEED);
+            trace->win_off += STREAM_WINDOW;
+            if (trace->win_off + STREAM_WINDOW <= trace->bin_map_len)
+                madvise((char *) trace->bin_map + trace->win_off,
+                        STREAM_WINDOW, MADV_WILLNEED);
+        }
+    }
+    return &trace->ops[i];
+}
+
+/*
+ * read_trace_bin - try to load the mmap'd binary companion of a trace
+ * (foo.rep -> foo.repb, written by traceconv).  The op records are used
+ * directly out of the mapping, so there is no parsing and no per-trace
+ * heap allocation for the ops array.  Returns false if no valid binary
+ * trace exists, in which case the caller parses the text file.
+ */
+static bool read_trace_bin(trace_t *trace)
+{
+    char binname[MAXLINE + 8];
+    bintrace_header_t *header;
+    struct stat st;
+    void *map;
+    int fd;
+
+    if (snprintf(binname, sizeof(binname), "%sb", trace->filename)
+        >= (int) sizeof(binname))
+        return false;
+    if ((fd = open(binname, O_RDONLY)) < 0)
+        return false;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(*header)) {
+        close(fd);
+        return false;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    header = (bintrace_header_t *) map;
+    if (memcmp(header->magic, BINTRACE_MAGIC, BINTRACE_MAGIC_LEN) != 0 ||
+        header->num_ops <= 0 ||
+        (size_t) st.st_size != sizeof(*header) +
+            header->num_ops * sizeof(bintraceop_t)) {
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    trace->weight = header->weight;
+    trace->num_ids = header->num_ids;
+    trace->num_ops = header->num_ops;
+    trace->data_bytes = header->data_bytes;
+    trace->ops = (traceop_t *) ((char *) map + sizeof(*header));
+    trace->bin_map = map;
+    trace->bin_map_len = st.st_size;
+    return true;
+}
+
 /*
  * read_trace - read a trace file and store it in memory
  */
@@ -853,9 +1548,20 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
         unix_error("malloc 1 failed in read_trace");
 
-    /* Read the trace file header */
     strcpy(trace->filename, tracedir);
     strcat(trace->filename, filename);
+    trace->bin_map = NULL;
+    trace->bin_map_len = 0;
+    trace->ops = NULL;
+    trace->fp = NULL;
+    trace->op_buf = NULL;
+    trace->live = NULL;
+
+    /* Prefer the zero-copy binary trace when one has been generated */
+    if (read_trace_bin(trace))
+        goto have_ops;
+
+    /* Read the trace file header */
     if ((tracefile = fopen(trace->filename, "r")) == NULL) {
         unix_error("Could not open %s in read_trace", trace->filename);
     }
@@ -870,27 +1576,22 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
         app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
     }
 
+    if (stream_mode) {
+        /* Leave the file open and parse the ops a chunk at a time */
+        if ((trace->ops_offset = ftell(tracefile)) < 0)
+            unix_error("ftell failed in read_trace");
+        trace->fp = tracefile;
+        if ((trace->op_buf =
+             (traceop_t *)malloc(STREAM_CHUNK * sizeof(traceop_t))) == NULL)
+            unix_error("malloc 2 failed in read_trace");
+        goto have_ops;
+    }
+
     /* We'll store each request line in the trace in this array */
     if ((trace->ops =
          (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
         unix_error("malloc 2 failed in read_trace");
 
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks =
-         (char **)calloc(trace->num_ids, sizeof(char *))) == NULL)
-        unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes =
-         (size_t *)calloc(trace->num_ids,  sizeof(size_t))) == NULL)
-        unix_error("malloc 4 failed in read_trace");
-
-    /* and, if we're debugging, the offset into the random data */
-    if ((trace->block_rand_base =
-         calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
-        unix_error("malloc 5 failed in read_trace");
-
-
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
@@ -926,6 +1627,42 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
 
+have_ops:
+    if (stream_mode) {
+        /* Only the ids with a live block get state, in a hash table */
+        size_t i;
+        trace->live_slots = LIVE_INIT_SLOTS;
+        trace->live_nlive = 0;
+        trace->live_nfilled = 0;
+        if ((trace->live =
+             (blockent_t *)malloc(trace->live_slots * sizeof(blockent_t)))
+            == NULL)
+            unix_error("malloc 3 failed in read_trace");
+        for (i = 0; i < trace->live_slots; i++)
+            trace->live[i].id = LIVE_EMPTY;
+        trace->blocks = NULL;
+        trace->block_sizes = NULL;
+        trace->block_rand_base = NULL;
+        goto have_ids;
+    }
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks =
+         (char **)calloc(trace->num_ids, sizeof(char *))) == NULL)
+        unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes =
+         (size_t *)calloc(trace->num_ids,  sizeof(size_t))) == NULL)
+        unix_error("malloc 4 failed in read_trace");
+
+    /* and, if we're debugging, the offset into the random data */
+    if ((trace->block_rand_base =
+         calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
+        unix_error("malloc 5 failed in read_trace");
+
+have_ids:
+
     /* fill in the stats */
     strcpy(stats->filename, trace->filename);
     stats->weight = trace->weight;
@@ -939,9 +1676,19 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
  */
 static void reinit_trace(trace_t *trace)
 {
-    memset(trace->blocks, 0, trace->num_ids * sizeof(*trace->blocks));
-    memset(trace->block_sizes, 0, trace->num_ids * sizeof(*trace->block_sizes));
-    /* block_rand_base is unused if size is zero */
+    if (stream_mode) {
+        size_t i;
+        for (i = 0; i < trace->live_slots; i++)
+            trace->live[i].id = LIVE_EMPTY;
+        trace->live_nlive = 0;
+        trace->live_nfilled = 0;
+    } else {
+        memset(trace->blocks, 0, trace->num_ids * sizeof(*trace->blocks));
+        memset(trace->block_sizes, 0,
+               trace->num_ids * sizeof(*trace->block_sizes));
+        /* block_rand_base is unused if size is zero */
+    }
+    trace_rewind(trace);
 }
 
 /*
@@ -950,10 +1697,17 @@ static void reinit_trace(trace_t *trace)
  */
 static void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->bin_map)       /* ops lives in the mapping for binary traces */
+        munmap(trace->bin_map, trace->bin_map_len);
+    else
+        free(trace->ops);     /* free the three arrays... */
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace->block_rand_base);
+    if (trace->fp)            /* streaming-mode state, if any */
+        fclose(trace->fp);
+    free(trace->op_buf);
+    free(trace->live);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -973,6 +1727,7 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
     char *newp;
     char *oldp;
     char *p;
+    const traceop_t *op;
 
     /* Reset the heap and free any records in the range list */
     mem_reset_brk();
@@ -985,9 +1740,9 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
     }
 
     /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
-        index = trace->ops[i].index;
-        size = trace->ops[i].size;
+    for (i = 0;  (op = trace_next_op(trace)) != NULL;  i++) {
+        index = op->index;
+        size = op->size;
 
         if (debug_mode == DBG_EXPENSIVE) {
             range_t *r;
@@ -1006,7 +1761,7 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
             }
         }
 
-        switch (trace->ops[i].type) {
+        switch (op->type) {
 
         case ALLOC: /* mm_malloc */
 
@@ -1025,8 +1780,8 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
                 return false;
 
             /* Remember region */
-            trace->blocks[index] = p;
-            trace->block_sizes[index] = size;
+            *trace_block(trace, index) = p;
+            *trace_block_size(trace, index) = size;
 
             /* Set to random data, for debugging. */
             randomize_block(trace, index);
@@ -1036,7 +1791,7 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
             check_index(trace, i, index);
 
             /* Call the student's realloc */
-            oldp = trace->blocks[index];
+            oldp = *trace_block(trace, index);
             newp = mm_realloc(oldp, size);
             if ( (newp == NULL) && (size != 0) ) {
                 malloc_error(trace, i, "mm_realloc failed.");
@@ -1060,14 +1815,14 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
 
             /* Move the region from where it was.
              * Check up to min(size, oldsize) for correct copying. */
-            trace->blocks[index] = newp;
-            if (size < trace->block_sizes[index]) {
-                trace->block_sizes[index] = size;
+            *trace_block(trace, index) = newp;
+            if (size < *trace_block_size(trace, index)) {
+                *trace_block_size(trace, index) = size;
             }
             // NOTE: Might help to pass old size here to check bytes at each end of allocation
 
             check_index(trace, i, index);
-            trace->block_sizes[index] = size;
+            *trace_block_size(trace, index) = size;
 
             /* Set to random data, for debugging. */
             randomize_block(trace, index);
@@ -1080,10 +1835,11 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
             if (index == -1) {
                 p = 0;
             } else {
-                p = trace->blocks[index];
+                p = *trace_block(trace, index);
                 remove_range(ranges, p);
             }
             mm_free(p);
+            live_drop(trace, index);
             break;
 
         default:
@@ -1100,21 +1856,22 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
  *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   package on the trace. Note that mem_sbrk() only shrinks the brk
+ *   pointer when heap trimming is explicitly enabled (it is off by
+ *   default), so in graded runs brk is always the high water mark of
+ *   the heap.
  *
  *   A higher number is better: 1 is optimal.
  */
 static double eval_mm_util(trace_t *trace, int tracenum)
 {
-    int i;
     int index;
     size_t size, newsize, oldsize;
     size_t max_total_size = 0;
     size_t total_size = 0;
     char *p;
     char *newp, *oldp;
+    const traceop_t *op;
 
     reinit_trace(trace);
 
@@ -1123,12 +1880,12 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     if (!mm_init())
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    while ((op = trace_next_op(trace)) != NULL) {
+        switch (op->type) {
 
         case ALLOC: /* mm_alloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = op->index;
+            size = op->size;
 
             if ((p = mm_malloc(size)) == NULL) {
                 app_error("trace %d: mm_malloc failed in eval_mm_util",
@@ -1136,41 +1893,42 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             }
 
             /* Remember region and size */
-            trace->blocks[index] = p;
-            trace->block_sizes[index] = size;
+            *trace_block(trace, index) = p;
+            *trace_block_size(trace, index) = size;
 
             total_size += size;
             break;
 
         case REALLOC: /* mm_realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
-            oldsize = trace->block_sizes[index];
+            index = op->index;
+            newsize = op->size;
+            oldsize = *trace_block_size(trace, index);
 
-            oldp = trace->blocks[index];
+            oldp = *trace_block(trace, index);
             if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0) {
                 app_error("trace %d: mm_realloc failed in eval_mm_util",
                           tracenum);
             }
 
             /* Remember region and size */
-            trace->blocks[index] = newp;
-            trace->block_sizes[index] = newsize;
+            *trace_block(trace, index) = newp;
+            *trace_block_size(trace, index) = newsize;
 
             total_size += (newsize - oldsize);
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = op->index;
             if (index < 0) {
                 size = 0;
                 p = 0;
             } else {
-                size = trace->block_sizes[index];
-                p = trace->blocks[index];
+                size = *trace_block_size(trace, index);
+                p = *trace_block(trace, index);
             }
 
             mm_free(p);
+            live_drop(trace, index);
 
             total_size -= size;
             break;
@@ -1199,46 +1957,54 @@ static double eval_mm_util(trace_t *trace, int tracenum)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index;
+    int index;
     size_t size, newsize;
     char *p, *newp, *oldp, *block;
+    const traceop_t *op;
     trace_t *trace = ((speed_t *)ptr)->trace;
     reinit_trace(trace);
 
-    /* Reset the heap and initialize the mm package */
-    mem_reset_brk();
-    if (!mm_init())
-        app_error("mm_init failed in eval_mm_speed");
+    if (speed_snapshot) {
+        /* Timed repetition: put the warmed heap back in one copy */
+        mem_restore();
+        mm_restore();
+    } else {
+        /* Reset the heap and initialize the mm package */
+        mem_reset_brk();
+        if (!mm_init())
+            app_error("mm_init failed in eval_mm_speed");
+    }
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+    while ((op = trace_next_op(trace)) != NULL)
+        switch (op->type) {
 
         case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = op->index;
+            size = op->size;
             if ((p = mm_malloc(size)) == NULL)
                 app_error("mm_malloc error in eval_mm_speed");
-            trace->blocks[index] = p;
+            *trace_block(trace, index) = p;
             break;
 
         case REALLOC: /* mm_realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
-            oldp = trace->blocks[index];
+            index = op->index;
+            newsize = op->size;
+            oldp = *trace_block(trace, index);
             if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
                 app_error("mm_realloc error in eval_mm_speed");
-            trace->blocks[index] = newp;
+            *trace_block(trace, index) = newp;
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = op->index;
             if (index < 0) {
                 block = 0;
             } else {
-                block = trace->blocks[index];
+                block = *trace_block(trace, index);
             }
             mm_free(block);
+            live_drop(trace, index);
             break;
 
         default:
@@ -1246,6 +2012,479 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/***********************************************************
+ * Benchmark mode (-B): statistically rigorous timing
+ *
+ * Instead of fcyc's minimum-seeking convergence loop, run a fixed
+ * number of warmup repetitions followed by individually timed
+ * measurement repetitions, and report the median with a nonparametric
+ * 95% confidence interval on it (order statistics, normal
+ * approximation of the binomial ranks).  Medians with intervals make
+ * run-to-run OS noise visible instead of silently folding it into the
+ * result, which is what lets 'make bench' gate on regressions.
+ **********************************************************/
+
+/* qsort comparison for doubles */
+static int dbl_cmp(const void *a, const void *b)
+{
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+    return (da > db) - (da < db);
+}
+
+/*
+ * bench_pin_cpu - pin the driver to the core it is currently on, so
+ * the scheduler cannot migrate the timed loops mid-measurement
+ */
+static void bench_pin_cpu(void)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    int cpu = sched_getcpu();
+    if (cpu < 0)
+        cpu = 0;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+        printf("Warning: could not pin to core %d\n", cpu);
+    else if (verbose > 1)
+        printf("Benchmark pinned to core %d\n", cpu);
+#endif
+}
+
+/*
+ * bench_mm_speed - time one trace in benchmark mode, filling in secs
+ * (median) and the secs_lo/secs_hi confidence interval
+ */
+static void bench_mm_speed(speed_t *speed_params, stats_t *stats)
+{
+    int n = bench_reps;
+    double *secs;
+    int r, lo, hi;
+    long batch = 1, b;
+    double sec = 0.0;
+    double min_time = 1000 * timer_resolution;
+    double halfwidth;
+
+    if ((secs = malloc(n * sizeof(double))) == NULL)
+        unix_error("malloc failed in bench_mm_speed");
+
+    for (r = 0; r < bench_warmup; r++)
+        eval_mm_speed(speed_params);
+
+    /* Short traces finish below timer resolution, so calibrate a batch
+       size that makes each measurement long enough to time */
+    while (sec < min_time) {
+        start_timer();
+        for (b = 0; b < batch; b++)
+            eval_mm_speed(speed_params);
+        sec = get_timer();
+        if (sec < min_time)
+            batch += batch;
+    }
+
+    for (r = 0; r < n; r++) {
+        start_timer();
+        for (b = 0; b < batch; b++)
+            eval_mm_speed(speed_params);
+        secs[r] = get_timer() / batch;
+    }
+    qsort(secs, n, sizeof(double), dbl_cmp);
+
+    stats->secs = (n % 2) ? secs[n / 2]
+                          : (secs[n / 2 - 1] + secs[n / 2]) / 2.0;
+
+    /* 95% CI on the median: ranks n/2 +/- 1.96*sqrt(n)/2 */
+    halfwidth = 1.96 * sqrt((double) n) / 2.0;
+    lo = (int) floor((double) n / 2.0 - halfwidth);
+    hi = (int) ceil((double) n / 2.0 + halfwidth);
+    if (lo < 0)
+        lo = 0;
+    if (hi > n - 1)
+        hi = n - 1;
+    stats->secs_lo = secs[lo];
+    stats->secs_hi = secs[hi];
+
+    free(secs);
+}
+
+/*
+ * bench_read_baseline - look up a trace's stored throughput interval;
+ * returns false if the file or the trace entry is missing
+ */
+static bool bench_read_baseline(const char *filename, const char *tracename,
+                                double *kops, double *kops_lo,
+                                double *kops_hi)
+{
+    FILE *fp;
+    char name[MAXLINE];
+    double k, k_lo, k_hi;
+    bool found = false;
+
+    if ((fp = fopen(filename, "r")) == NULL)
+        return false;
+    while (fscanf(fp, "%s %lf %lf %lf", name, &k, &k_lo, &k_hi) == 4) {
+        if (strcmp(name, tracename) == 0) {
+            *kops = k;
+            *kops_lo = k_lo;
+            *kops_hi = k_hi;
+            found = true;
+            break;
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+/*
+ * bench_report - print per-trace median throughput with confidence
+ * intervals, optionally update the stored baseline (-u), and compare
+ * against a baseline (-b).  A trace regresses when its measured
+ * interval lies entirely below the baseline's stored interval; as long
+ * as the two intervals overlap, the difference is within noise.
+ * Returns the number of regressions.
+ */
+static int bench_report(int n, stats_t *stats)
+{
+    int i;
+    int regressions = 0;
+    FILE *update = NULL;
+
+    if (bench_update_file[0] != '\0') {
+        if ((update = fopen(bench_update_file, "w")) == NULL)
+            unix_error("Could not write baseline file %s", bench_update_file);
+    }
+
+    printf("\nBenchmark results (%d warmup + %d measured reps):\n",
+           bench_warmup, bench_reps);
+    printf("%8s %8s %8s  %s\n", "Kops", "lo95", "hi95", "trace");
+    for (i = 0; i < n; i++) {
+        double kops, kops_lo, kops_hi;
+
+        if (!stats[i].valid || stats[i].secs <= 0)
+            continue;
+        kops = stats[i].ops * 1e-3 / stats[i].secs;
+        kops_lo = stats[i].ops * 1e-3 / stats[i].secs_hi;
+        kops_hi = stats[i].ops * 1e-3 / stats[i].secs_lo;
+        printf("%8.0f %8.0f %8.0f  %s\n",
+               kops, kops_lo, kops_hi, stats[i].filename);
+
+        if (update)
+            fprintf(update, "%s %.1f %.1f %.1f\n",
+                    stats[i].filename, kops, kops_lo, kops_hi);
+
+        if (bench_compare_file[0] != '\0') {
+            double base, base_lo, base_hi;
+            if (!bench_read_baseline(bench_compare_file, stats[i].filename,
+                                     &base, &base_lo, &base_hi)) {
+                printf("  no baseline entry for %s\n", stats[i].filename);
+            } else if (kops_hi * (1.0 + bench_margin) < base_lo) {
+                printf("  REGRESSION: %s: baseline %.0f [%.0f, %.0f] vs "
+                       "measured %.0f [%.0f, %.0f] Kops\n",
+                       stats[i].filename, base, base_lo, base_hi,
+                       kops, kops_lo, kops_hi);
+                regressions++;
+            }
+        }
+    }
+    if (update) {
+        fclose(update);
+        printf("Baseline written to %s\n", bench_update_file);
+    }
+    if (bench_compare_file[0] != '\0') {
+        if (regressions)
+            printf("%d trace(s) regressed beyond their confidence "
+                   "interval\n", regressions);
+        else
+            printf("No regressions against %s\n", bench_compare_file);
+    }
+    return regressions;
+}
+
+/***********************************************************
+ * Threaded replay mode (-p): multi-threaded trace benchmark
+ *
+ * N replay threads are released from a barrier, each driving a private
+ * copy of the trace against the shared allocator, so the measurement
+ * exercises real concurrent malloc/free traffic instead of fcyc's
+ * single-threaded loop.  With -x each thread hands every block it
+ * frees to its successor over a lock-free stack and frees whatever its
+ * predecessor hands it, so every free is remote -- the
+ * producer/consumer pattern that is the hardest case for per-thread
+ * caches and arena ownership.  A 1-thread baseline is measured through
+ * the same harness, and threads_report prints per-trace aggregate and
+ * per-thread Kops/s plus scaling efficiency against that baseline.
+ *
+ * The allocator linked in must be thread-safe: use an MM_ARENAS build
+ * (the mdriver-mt Makefile target).  The default single-arena build
+ * has no locking and will corrupt its free structures under -p.
+ **********************************************************/
+
+/* Per-thread replay state */
+typedef struct {
+    int id;                /* thread index, 0..count-1 */
+    int count;             /* number of replay threads in the run */
+    trace_t *trace;        /* private copy of the trace */
+    int reps;              /* replay repetitions */
+    bool remote;           /* hand frees to the successor thread */
+    double secs;           /* this thread's elapsed seconds */
+    double ops_done;       /* ops this thread executed */
+} replay_thread_t;
+
+/* One lock-free stack of freed blocks per thread: thread t pushes onto
+ * stack (t+1)%count and drains its own.  The link pointer lives in the
+ * freed block's payload, which every block can hold (the allocator's
+ * minimum block size exceeds a pointer).  When cores are oversubscribed
+ * a descheduled consumer can fall a whole timeslice behind its
+ * producer, so the backlog is capped: past REMOTE_PENDING_MAX blocks
+ * the producer frees locally instead of letting the heap high-water
+ * mark ratchet up. */
+#define REMOTE_PENDING_MAX 4096
+static char *remote_stack[THREADS_MAX];
+static int remote_pending[THREADS_MAX];
+static volatile int replay_done[THREADS_MAX];
+static pthread_barrier_t replay_barrier;
+static double replay_begin;    /* common start, taken by thread 0 */
+static double replay_end;      /* latest finish over all threads */
+static pthread_mutex_t replay_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* wall-clock seconds, monotonic */
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* push a freed block onto a thread's incoming stack, or free it
+ * locally when that thread's backlog is already deep */
+static void remote_push(int target, char *block)
+{
+    char *head;
+
+    if (__atomic_load_n(&remote_pending[target], __ATOMIC_RELAXED) >
+        REMOTE_PENDING_MAX) {
+        mm_free(block);
+        return;
+    }
+    head = __atomic_load_n(&remote_stack[target], __ATOMIC_RELAXED);
+    do {
+        *(char **) block = head;
+    } while (!__atomic_compare_exchange_n(&remote_stack[target], &head,
+                                          block, true, __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+    __atomic_fetch_add(&remote_pending[target], 1, __ATOMIC_RELAXED);
+}
+
+/* free every block other threads have handed to this one */
+static void remote_drain(int self)
+{
+    char *head = __atomic_exchange_n(&remote_stack[self], NULL,
+                                     __ATOMIC_ACQUIRE);
+    int drained = 0;
+
+    while (head != NULL) {
+        char *next = *(char **) head;
+        mm_free(head);
+        head = next;
+        drained++;
+    }
+    if (drained > 0)
+        __atomic_fetch_sub(&remote_pending[self], drained, __ATOMIC_RELAXED);
+}
+
+/*
+ * replay_thread - body of one replay thread: replay the private trace
+ * copy reps times, timing from the barrier to the last op (including,
+ * in remote mode, the final sweep of the incoming stack)
+ */
+static void *replay_thread(void *arg)
+{
+    replay_thread_t *t = (replay_thread_t *) arg;
+    trace_t *trace = t->trace;
+    int succ = (t->id + 1) % t->count;
+    const traceop_t *op;
+    char *p, *oldp, *block;
+    double start, end;
+    int index, r;
+    unsigned steps = 0;
+
+    pthread_barrier_wait(&replay_barrier);
+    start = now_secs();
+    if (t->id == 0)
+        replay_begin = start;
+
+    for (r = 0; r < t->reps; r++) {
+        reinit_trace(trace);
+        while ((op = trace_next_op(trace)) != NULL) {
+            index = op->index;
+            switch (op->type) {
+
+            case ALLOC:
+                if ((p = mm_malloc(op->size)) == NULL)
+                    app_error("mm_malloc error in replay_thread");
+                *trace_block(trace, index) = p;
+                break;
+
+            case REALLOC:
+                oldp = *trace_block(trace, index);
+                if ((p = mm_realloc(oldp, op->size)) == NULL && op->size != 0)
+                    app_error("mm_realloc error in replay_thread");
+                *trace_block(trace, index) = p;
+                break;
+
+            case FREE:
+                block = (index < 0) ? NULL : *trace_block(trace, index);
+                if (t->remote && block != NULL)
+                    remote_push(succ, block);
+                else
+                    mm_free(block);
+                if (index >= 0)
+                    *trace_block(trace, index) = NULL;
+                live_drop(trace, index);
+                break;
+
+            default:
+                app_error("Nonexistent request type in replay_thread");
+            }
+            /* frees arriving from the predecessor are part of the work */
+            if (t->remote && (++steps & 63) == 0)
+                remote_drain(t->id);
+        }
+        t->ops_done += trace->num_ops;
+
+        /* free whatever the trace left live, so repetitions do not
+           accumulate leaked blocks until the simulated heap runs out */
+        for (index = 0; index < trace->num_ids; index++) {
+            if (trace->blocks[index] != NULL) {
+                mm_free(trace->blocks[index]);
+                trace->blocks[index] = NULL;
+            }
+        }
+    }
+
+    if (t->remote) {
+        int pred = (t->id + t->count - 1) % t->count;
+        __atomic_store_n(&replay_done[t->id], 1, __ATOMIC_RELEASE);
+        /* keep sweeping until the predecessor has pushed its last block */
+        while (!__atomic_load_n(&replay_done[pred], __ATOMIC_ACQUIRE)) {
+            remote_drain(t->id);
+            sched_yield();
+        }
+        remote_drain(t->id);
+    }
+
+    end = now_secs();
+    t->secs = end - start;
+    pthread_mutex_lock(&replay_lock);
+    if (end > replay_end)
+        replay_end = end;
+    pthread_mutex_unlock(&replay_lock);
+    return NULL;
+}
+
+/*
+ * run_replay - one timed measurement with count threads; returns the
+ * aggregate Kops/s and fills in the per-thread extremes
+ */
+static double run_replay(int count, bool remote, const char *tracedir,
+                         char *tracefile, double *kops_min, double *kops_max)
+{
+    replay_thread_t *threads;
+    pthread_t *tids;
+    stats_t scratch;
+    double total_ops = 0, wall, kops;
+    int i;
+
+    if ((threads = calloc(count, sizeof(replay_thread_t))) == NULL ||
+        (tids = calloc(count, sizeof(pthread_t))) == NULL)
+        unix_error("calloc failed in run_replay");
+
+    memset((void *) remote_stack, 0, sizeof(remote_stack));
+    memset((void *) remote_pending, 0, sizeof(remote_pending));
+    memset((void *) replay_done, 0, sizeof(replay_done));
+    replay_begin = replay_end = 0;
+    pthread_barrier_init(&replay_barrier, NULL, count);
+
+    for (i = 0; i < count; i++) {
+        memset(&scratch, 0, sizeof(scratch));
+        threads[i].id = i;
+        threads[i].count = count;
+        threads[i].trace = read_trace(&scratch, tracedir, tracefile);
+        threads[i].remote = remote;
+        threads[i].reps = THREADS_TARGET_OPS / threads[i].trace->num_ops;
+        if (threads[i].reps < 1)
+            threads[i].reps = 1;
+    }
+    for (i = 0; i < count; i++) {
+        if (pthread_create(&tids[i], NULL, replay_thread, &threads[i]) != 0)
+            unix_error("pthread_create failed in run_replay");
+    }
+    for (i = 0; i < count; i++)
+        pthread_join(tids[i], NULL);
+
+    *kops_min = *kops_max = 0;
+    for (i = 0; i < count; i++) {
+        double k = threads[i].ops_done * 1e-3 / threads[i].secs;
+        total_ops += threads[i].ops_done;
+        if (i == 0 || k < *kops_min)
+            *kops_min = k;
+        if (i == 0 || k > *kops_max)
+            *kops_max = k;
+        free_trace(threads[i].trace);
+    }
+    wall = replay_end - replay_begin;
+    kops = (wall > 0) ? total_ops * 1e-3 / wall : 0;
+
+    pthread_barrier_destroy(&replay_barrier);
+    free(threads);
+    free(tids);
+    return kops;
+}
+
+/*
+ * threads_mm_speed - measure one trace with nthreads replay threads
+ * plus a 1-thread baseline, filling in the thr_* stats fields
+ */
+static void threads_mm_speed(stats_t *stats, const char *tracedir,
+                             char *tracefile)
+{
+    double kmin, kmax;
+
+    stats->thr_base_kops = run_replay(1, false, tracedir, tracefile,
+                                      &kmin, &kmax);
+    stats->thr_kops = run_replay(nthreads, remote_frees, tracedir,
+                                 tracefile, &kmin, &kmax);
+    stats->thr_kops_min = kmin;
+    stats->thr_kops_max = kmax;
+}
+
+/*
+ * threads_report - print per-trace aggregate and per-thread throughput
+ * with scaling efficiency: aggregate Kops/s over nthreads times the
+ * 1-thread baseline
+ */
+static void threads_report(int n, stats_t *stats)
+{
+    int i;
+
+    printf("\nThreaded replay (%d threads%s):\n", nthreads,
+           remote_frees ? ", remote frees" : "");
+    printf("%8s %8s %8s %8s %6s  %s\n",
+           "1-thr", "aggr", "min/thr", "max/thr", "eff", "trace");
+    for (i = 0; i < n; i++) {
+        double eff;
+
+        if (!stats[i].valid || stats[i].thr_base_kops <= 0)
+            continue;
+        eff = stats[i].thr_kops / (stats[i].thr_base_kops * nthreads) * 100.0;
+        printf("%8.0f %8.0f %8.0f %8.0f %5.1f%%  %s\n",
+               stats[i].thr_base_kops, stats[i].thr_kops,
+               stats[i].thr_kops_min, stats[i].thr_kops_max, eff,
+               stats[i].filename);
+    }
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1257,36 +2496,38 @@ static bool eval_libc_valid(trace_t *trace)
     int i;
     size_t newsize;
     char *p, *newp, *oldp;
+    const traceop_t *op;
 
     reinit_trace(trace);
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    for (i = 0;  (op = trace_next_op(trace)) != NULL;  i++) {
+        switch (op->type) {
 
         case ALLOC: /* malloc */
-            if ((p = malloc(trace->ops[i].size)) == NULL) {
+            if ((p = malloc(op->size)) == NULL) {
                 malloc_error(trace, i, "libc malloc failed");
                 unix_error("System message");
             }
-            trace->blocks[trace->ops[i].index] = p;
+            *trace_block(trace, op->index) = p;
             break;
 
         case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-            oldp = trace->blocks[trace->ops[i].index];
+            newsize = op->size;
+            oldp = *trace_block(trace, op->index);
             if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0) {
                 malloc_error(trace, i, "libc realloc failed");
                 unix_error("System message");
             }
-            trace->blocks[trace->ops[i].index] = newp;
+            *trace_block(trace, op->index) = newp;
             break;
 
         case FREE: /* free */
-            if (trace->ops[i].index >= 0) {
-                free(trace->blocks[trace->ops[i].index]);
+            if (op->index >= 0) {
+                free(*trace_block(trace, op->index));
             } else {
                 free(0);
             }
+            live_drop(trace, op->index);
             break;
 
         default:
@@ -1304,42 +2545,43 @@ static bool eval_libc_valid(trace_t *trace)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
     int index;
     size_t size, newsize;
     char *p, *newp, *oldp, *block;
+    const traceop_t *op;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     reinit_trace(trace);
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    while ((op = trace_next_op(trace)) != NULL) {
+        switch (op->type) {
         case ALLOC: /* malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = op->index;
+            size = op->size;
             if ((p = malloc(size)) == NULL)
                 unix_error("malloc failed in eval_libc_speed");
-            trace->blocks[index] = p;
+            *trace_block(trace, index) = p;
             break;
 
         case REALLOC: /* realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
-            oldp = trace->blocks[index];
+            index = op->index;
+            newsize = op->size;
+            oldp = *trace_block(trace, index);
             if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0)
                 unix_error("realloc failed in eval_libc_speed\n");
 
-            trace->blocks[index] = newp;
+            *trace_block(trace, index) = newp;
             break;
 
         case FREE: /* free */
-            index = trace->ops[i].index;
+            index = op->index;
             if (index >= 0) {
-                block = trace->blocks[index];
+                block = *trace_block(trace, index);
                 free(block);
             } else {
                 free(0);
             }
+            live_drop(trace, index);
             break;
         }
     }
@@ -1350,9 +2592,46 @@ static void eval_libc_speed(void *ptr)
  ************************************/
 
 
+/*
+ * print_perf_field - print one per-op hardware counter column; "-"
+ * when the event was unavailable
+ */
+static void print_perf_field(double count, double ops)
+{
+    if (count < 0 || ops <= 0) {
+        if (tab_mode)
+            printf("-\t");
+        else
+            printf("%9s", "-");
+    } else {
+        if (tab_mode)
+            printf("%.4f\t", count / ops);
+        else
+            printf("%9.3f", count / ops);
+    }
+}
+
+/*
+ * print_perf_fields - the four counter columns for one trace
+ */
+static void print_perf_fields(const perf_counts_t *perf, double ops)
+{
+    if (perf->valid) {
+        print_perf_field(perf->l1d_misses, ops);
+        print_perf_field(perf->llc_misses, ops);
+        print_perf_field(perf->branch_misses, ops);
+        print_perf_field(perf->dtlb_misses, ops);
+    } else {
+        print_perf_field(-1.0, ops);
+        print_perf_field(-1.0, ops);
+        print_perf_field(-1.0, ops);
+        print_perf_field(-1.0, ops);
+    }
+}
+
 /*
  * printresults - prints a performance summary for some malloc package and returns
- *                a summary of the stats to the caller. 
+ *                a summary of the stats to the caller.
  */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
 {
@@ -1370,10 +2649,12 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
 
     /* Print the individual results for each trace */
     if (tab_mode) {
-        printf("valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\ttrace\n");
+        printf("valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\t"
+               "l1m/op\tllcm/op\tbrm/op\ttlbm/op\ttrace\n");
     } else {
-        printf("  %5s  %6s %7s%8s%8s  %s\n",
-               "valid", "util", "ops", "msecs", "Kops", "trace");
+        printf("  %5s  %6s %7s%8s%8s%9s%9s%9s%9s  %s\n",
+               "valid", "util", "ops", "msecs", "Kops",
+               "l1m/op", "llcm/op", "brm/op", "tlbm/op", "trace");
     }
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
@@ -1436,7 +2717,10 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
                     printf("%8s%10s%7s ", "--", "--", "--");
             }
 
-            printf("%s\n", stats[i].filename);
+            /* Hardware counters from the timed run */
+            print_perf_fields(&stats[i].perf, stats[i].ops);
+
+            printf(tab_mode ? "%s\n" : " %s\n", stats[i].filename);
 
             if (stats[i].weight == WALL || stats[i].weight == WPERF)
                 {
@@ -1452,15 +2736,19 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
         }
         else {
             if (tab_mode) {
-                printf("no\t\t\t\t\t\t\t%s\n", stats[i].filename);
+                printf("no\t\t\t\t\t\t\t\t\t\t\t%s\n", stats[i].filename);
             } else {
-                printf("%2s%4s%7s%10s%7s%10s %s\n",
+                printf("%2s%4s%7s%10s%7s%10s%9s%9s%9s%9s %s\n",
                        stats[i].weight != 0 ? "*" : "",
                        "no",
                        "-",
                        "-",
                        "-",
                        "-",
+                       "-",
+                       "-",
+                       "-",
+                       "-",
                        stats[i].filename);
             }
         }
@@ -1689,10 +2977,10 @@ static double measure_ref_throughput() {
     if (ltput > 0)
 	return ltput;
     char buf[MAXLINE];
-    char cmd[MAXLINE];
+    char cmd[2*MAXLINE];
     char *fname = gen_file_name("./tput_%.8x.txt", buf, MAXLINE);
     float t;
-    sprintf(cmd, "%s > %s", REF_DRIVER,
+    snprintf(cmd, sizeof(cmd), "%s > %s", REF_DRIVER,
 	    fname);
     if (verbose > 1) {
 	printf("Executing '%s'\n", cmd);
@@ -1712,7 +3000,7 @@ static double measure_ref_throughput() {
     }
     if (fclose(f) != 0) {
 	fprintf(stderr, "Couldn't close '%s'\n", fname);
-    }    sprintf(cmd, "rm -f %s", fname);
+    }    snprintf(cmd, sizeof(cmd), "rm -f %s", fname);
     if (system(cmd) != 0) {
 	fprintf(stderr, "Couldn't delete '%s'\n", fname);
     }
@@ -1732,10 +3020,22 @@ static void usage(char *prog)
     fprintf(stderr, "\t-c <file>  Run trace file <file> once, check for correctness only.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate traces in <n> parallel worker processes.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
     fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-T         Print diagnostics in tab mode\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file\n");
+    fprintf(stderr, "\t-S         Stream traces: bounded op window plus a live-id table,\n");
+    fprintf(stderr, "\t           for traces too large to hold in memory.\n");
+    fprintf(stderr, "\t-B <n>     Benchmark mode: time <n> reps per trace, report median and 95%% CI.\n");
+    fprintf(stderr, "\t-w <n>     Benchmark mode: run <n> warmup reps first (default 3).\n");
+    fprintf(stderr, "\t-b <file>  Benchmark mode: fail if throughput regresses vs baseline <file>.\n");
+    fprintf(stderr, "\t-u <file>  Benchmark mode: write measured throughputs to baseline <file>.\n");
+    fprintf(stderr, "\t-m <pct>   Benchmark mode: allow <pct>%% extra slack in the gate (machine drift).\n");
+    fprintf(stderr, "\t-p <n>     Threaded replay: drive each trace with <n> concurrent threads\n");
+    fprintf(stderr, "\t           and report scaling efficiency (needs a thread-safe allocator,\n");
+    fprintf(stderr, "\t           see the mdriver-mt Makefile target).\n");
+    fprintf(stderr, "\t-x         Threaded replay: each thread frees its neighbor's blocks.\n");
 }
@@ -24,27 +24,77 @@ static unsigned char *mem_brk;              /* Current position of break */
 static unsigned char *mem_max_addr;         /* Maximum allowable heap address */
 static size_t mmap_length;                  /* Number of bytes allocated by mmap */
 
-/* 
+/*
+ * Heap mapping modes (chosen once per process via the environment):
+ *
+ *   default            dense MAX_DENSE_HEAP mapping of /dev/zero, as
+ *                      the driver has always used
+ *   MEMLIB_SPARSE=<mb> MAP_NORESERVE anonymous reservation of <mb>
+ *                      megabytes (default 4096 when <mb> is not a
+ *                      number > 1); pages are only committed as the
+ *                      trace touches them, so multi-GB heaps neither
+ *                      reserve swap nor slow down startup
+ *   MEMLIB_HUGEPAGES=1 back the heap with huge pages: MAP_HUGETLB
+ *                      when the system has a hugetlb pool, otherwise
+ *                      MADV_HUGEPAGE so THP can coalesce the mapping
+ */
+#define SPARSE_HEAP_DEFAULT_MB 4096UL
+#define HUGE_PAGE_BYTES (2UL << 20)
+
+/*
  * mem_init - initialize the memory system model
  */
 void mem_init(){
-    /* Dense allocation */
-    mmap_length = MAX_DENSE_HEAP;
-
-    int dev_zero = open("/dev/zero", O_RDWR);
+    const char *sparse = getenv("MEMLIB_SPARSE");
+    const char *huge = getenv("MEMLIB_HUGEPAGES");
     void *start = TRY_DENSE_HEAP_START;
-    void *addr = mmap(start,        /* suggested start*/
-		      mmap_length,  /* length */
-		      PROT_WRITE,   /* permissions */
-		      MAP_PRIVATE,  /* private or shared? */
-		      dev_zero,	    /* fd */
-		      0);	    /* offset */
+    void *addr = MAP_FAILED;
+    int flags = MAP_PRIVATE;
+
+    if (sparse != NULL) {
+	size_t mb = (size_t) atol(sparse);
+	if (mb <= 1)
+	    mb = SPARSE_HEAP_DEFAULT_MB;
+	mmap_length = mb << 20;
+	flags |= MAP_ANONYMOUS | MAP_NORESERVE;
+    } else {
+	/* Dense allocation */
+	mmap_length = MAX_DENSE_HEAP;
+    }
+
+    if (huge != NULL && *huge != '0') {
+	/* Round up so a hugetlb mapping is legal, and try it first.
+	   Deliberately without MAP_NORESERVE: hugetlb pages come from a
+	   fixed pool, and an unreservable mapping would SIGBUS on first
+	   touch instead of falling back cleanly here. */
+	mmap_length = (mmap_length + HUGE_PAGE_BYTES - 1) &
+		      ~(HUGE_PAGE_BYTES - 1);
+	addr = mmap(start, mmap_length, PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (addr == MAP_FAILED && (flags & MAP_ANONYMOUS)) {
+	addr = mmap(start, mmap_length, PROT_WRITE, flags, -1, 0);
+    }
+    if (addr == MAP_FAILED) {
+	int dev_zero = open("/dev/zero", O_RDWR);
+	addr = mmap(start,        /* suggested start*/
+		    mmap_length,  /* length */
+		    PROT_WRITE,   /* permissions */
+		    MAP_PRIVATE,  /* private or shared? */
+		    dev_zero,	    /* fd */
+		    0);	    /* offset */
+    }
     if (addr == MAP_FAILED) {
 	fprintf(stderr, "FAILURE.  mmap couldn't allocate space for heap\n");
 	exit(1);
     }
+#ifdef MADV_HUGEPAGE
+    /* No hugetlb pool: ask THP to back the ordinary mapping instead */
+    if (huge != NULL && *huge != '0')
+	madvise(addr, mmap_length, MADV_HUGEPAGE);
+#endif
     heap = addr;
-    mem_max_addr = heap + MAX_DENSE_HEAP;
+    mem_max_addr = heap + mmap_length;
     mem_reset_brk();
 }
 
@@ -62,25 +112,43 @@ void mem_reset_brk(){
     mem_brk = heap;
 }
 
-/* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *		by incr bytes and returns the start address of the new area. In
- *		this model, the heap cannot be shrunk.
+/*
+ * mem_decommit - return the whole pages inside [addr, addr+len) to the
+ * OS with madvise.  The memory stays mapped and reads back as zero, so
+ * callers may only decommit bytes whose contents they can afford to
+ * lose.  Partial pages at either end are left untouched.
+ */
+void mem_decommit(void *addr, size_t len) {
+    size_t page = mem_pagesize();
+    uintptr_t lo = ((uintptr_t) addr + page - 1) & ~(page - 1);
+    uintptr_t hi = ((uintptr_t) addr + len) & ~(page - 1);
+    if (hi > lo)
+	madvise((void *) lo, hi - lo, MADV_DONTNEED);
+}
+
+/*
+ * mem_sbrk - simple model of the sbrk function. Extends the heap
+ *		by incr bytes and returns the start address of the new area.
+ *		Negative increments shrink the heap, releasing the pages in
+ *		the abandoned tail, as long as the break stays at or above
+ *		the start of the heap.
  */
 void *mem_sbrk(intptr_t incr) {
     unsigned char *old_brk = mem_brk;
 
     bool ok = true;
-    if (incr < 0) {
+    if (incr < 0 && mem_brk + incr < heap) {
 	ok = false;
-	fprintf(stderr, "ERROR: mem_sbrk failed.  Attempt to expand heap by negative value %ld\n", (long) incr);
-    } else if (mem_brk + incr > mem_max_addr) {
+	fprintf(stderr, "ERROR: mem_sbrk failed.  Attempt to shrink heap below its start (increment %ld)\n", (long) incr);
+    } else if (incr > 0 && mem_brk + incr > mem_max_addr) {
 	ok = false;
 	size_t alloc = mem_brk - heap + incr;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory.  Would require heap size of %zd (0x%zx) bytes\n", alloc, alloc);
     }
     if (ok) {
 	mem_brk += incr;
+	if (incr < 0)
+	    mem_decommit(mem_brk, (size_t) -incr);
 	return (void *) old_brk;
     } else {
 	errno = ENOMEM;
@@ -88,6 +156,42 @@ void *mem_sbrk(intptr_t incr) {
     }
 }
 
+/*
+ * Heap snapshot: one saved copy of the in-use heap bytes and break,
+ * so timed repetitions can restore a warmed heap in a single memcpy
+ * instead of replaying the whole extend ramp from a cold start. Only
+ * the region below the break is copied, so sparse multi-GB mappings
+ * cost no more than their committed part.
+ */
+static unsigned char *snap_buf;
+static size_t snap_cap;
+static size_t snap_size;
+
+/*
+ * mem_snapshot - capture the current heap contents and break
+ */
+void mem_snapshot(void) {
+    snap_size = (size_t)(mem_brk - heap);
+    if (snap_size > snap_cap) {
+	free(snap_buf);
+	snap_buf = malloc(snap_size);
+	if (snap_buf == NULL) {
+	    fprintf(stderr, "FAILURE.  malloc couldn't allocate snapshot buffer\n");
+	    exit(1);
+	}
+	snap_cap = snap_size;
+    }
+    memcpy(snap_buf, heap, snap_size);
+}
+
+/*
+ * mem_restore - put the heap back to the last mem_snapshot
+ */
+void mem_restore(void) {
+    memcpy(heap, snap_buf, snap_size);
+    mem_brk = heap + snap_size;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -109,6 +213,13 @@ size_t mem_heapsize() {
     return (size_t)(mem_brk - heap);
 }
 
+/*
+ * mem_heap_capacity() - returns the total size the heap can grow to
+ */
+size_t mem_heap_capacity() {
+    return (size_t)(mem_max_addr - heap);
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
@@ -118,6 +229,77 @@ size_t mem_pagesize(){
 
 /*************** Memory emulation  *******************/
 
+/*
+ * The bulk loops of mem_memcpy and mem_memset get SIMD fast paths on
+ * x86-64, selected once at runtime so the same binary runs on machines
+ * with and without AVX2/AVX-512.  The helpers move whole vectors only;
+ * the scalar word loop below always handles the tail.
+ */
+static int simd_level = -1;    /* -1 undetected, 0 scalar, 1 AVX2, 2 AVX-512 */
+
+static void detect_simd(void) {
+    simd_level = 0;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+	simd_level = 1;
+    if (__builtin_cpu_supports("avx512f"))
+	simd_level = 2;
+#endif
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+/* Copy as many whole 32-byte vectors as fit; returns bytes copied */
+__attribute__((target("avx2")))
+static size_t memcpy_avx2(unsigned char *dst, const unsigned char *src,
+			  size_t n) {
+    size_t done = 0;
+    while (n - done >= 32) {
+	__m256i v = _mm256_loadu_si256((const __m256i *) (src + done));
+	_mm256_storeu_si256((__m256i *) (dst + done), v);
+	done += 32;
+    }
+    return done;
+}
+
+__attribute__((target("avx512f")))
+static size_t memcpy_avx512(unsigned char *dst, const unsigned char *src,
+			    size_t n) {
+    size_t done = 0;
+    while (n - done >= 64) {
+	__m512i v = _mm512_loadu_si512((const void *) (src + done));
+	_mm512_storeu_si512((void *) (dst + done), v);
+	done += 64;
+    }
+    return done;
+}
+
+/* Fill as many whole 32-byte vectors as fit; returns bytes filled */
+__attribute__((target("avx2")))
+static size_t memset_avx2(unsigned char *dst, int c, size_t n) {
+    __m256i v = _mm256_set1_epi8((char) c);
+    size_t done = 0;
+    while (n - done >= 32) {
+	_mm256_storeu_si256((__m256i *) (dst + done), v);
+	done += 32;
+    }
+    return done;
+}
+
+__attribute__((target("avx512f")))
+static size_t memset_avx512(unsigned char *dst, int c, size_t n) {
+    __m512i v = _mm512_set1_epi8((char) c);
+    size_t done = 0;
+    while (n - done >= 64) {
+	_mm512_storeu_si512((void *) (dst + done), v);
+	done += 64;
+    }
+    return done;
+}
+#endif /* __x86_64__ */
+
 /* Read len bytes and return value zero-extended to 64 bits */
 uint64_t mem_read(const void *addr, size_t len) {
     uint64_t rdata;
@@ -143,6 +325,20 @@ void mem_write(void *addr, uint64_t val, size_t len) {
 void *mem_memcpy(void *dst, const void *src, size_t n) {
     void *savedst = dst;
     size_t w = sizeof(uint64_t);
+    if (simd_level < 0)
+	detect_simd();
+#if defined(__x86_64__)
+    {
+	size_t done = 0;
+	if (simd_level >= 2 && n >= 64)
+	    done = memcpy_avx512(dst, src, n);
+	else if (simd_level >= 1 && n >= 32)
+	    done = memcpy_avx2(dst, src, n);
+	dst = (void *) ((unsigned char *) dst + done);
+	src = (void *) ((const unsigned char *) src + done);
+	n -= done;
+    }
+#endif
     while (n >= w) {
 	uint64_t data = mem_read(src, w);
 	mem_write(dst, data, w);
@@ -167,6 +363,19 @@ void *mem_memset(void *dst, int c, size_t n) {
     for (i = 0; i < w; i++) {
 	data = data | (byte << (8*i));
     }
+    if (simd_level < 0)
+	detect_simd();
+#if defined(__x86_64__)
+    {
+	size_t done = 0;
+	if (simd_level >= 2 && n >= 64)
+	    done = memset_avx512(dst, c, n);
+	else if (simd_level >= 1 && n >= 32)
+	    done = memset_avx2(dst, c, n);
+	dst = (void *) ((unsigned char *) dst + done);
+	n -= done;
+    }
+#endif
     while (n >= w) {
 	mem_write(dst, data, w);
 	n -= w;
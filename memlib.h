@@ -5,12 +5,23 @@
 void mem_init();               
 void mem_deinit(void);
 void *mem_sbrk(intptr_t incr);
+
+/* Return the whole pages inside [addr, addr+len) to the OS; the
+   memory stays mapped and reads back as zero */
+void mem_decommit(void *addr, size_t len);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_heap_capacity(void);
 size_t mem_pagesize(void);
 
+/* Capture / restore the heap contents and break in one copy; pair
+   with mm_snapshot/mm_restore so timed repetitions reuse a warmed
+   heap instead of re-initializing */
+void mem_snapshot(void);
+void mem_restore(void);
+
 /* Functions used for memory emulation */
 
 /* Read len bytes and return value zero-extended to 64 bits */
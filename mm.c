@@ -17,6 +17,28 @@
 #include "mm.h"
 #include "memlib.h"
 
+/*
+ * Arena mode: compile with -DMM_ARENAS=N (and -lpthread) to get N
+ * independent arenas, each with its own free structures and heap
+ * segments, with threads pinned to arenas by thread-id hash. Frees of
+ * blocks owned by another arena are pushed onto the owner's lock-free
+ * deferred stack and drained by the owner on its next allocation.
+ * Without MM_ARENAS the allocator compiles down to the single-arena
+ * code with no locking.
+ */
+#ifdef MM_ARENAS
+#include <pthread.h>
+#if MM_ARENAS > 4
+#error "MM_ARENAS cannot exceed 4: the owner id lives in header bits 2-3"
+#endif
+#ifdef MM_DEFER_COALESCE
+#error "MM_DEFER_COALESCE relies on a contiguous heap walk and cannot be combined with MM_ARENAS"
+#endif
+#define MM_ARENA_COUNT MM_ARENAS
+#else
+#define MM_ARENA_COUNT 1
+#endif /* MM_ARENAS */
+
 /*
  * If you want debugging output, uncomment the following. Be sure not
  * to have debugging enabled in your final submission
@@ -40,32 +62,112 @@
 #define free mm_free
 #define realloc mm_realloc
 #define calloc mm_calloc
+#define aligned_alloc mm_aligned_alloc
+#define memalign mm_memalign
 #define memset mem_memset
 #define memcpy mem_memcpy
 #endif /* DRIVER */
 
+/*
+ * Workload profiles: compile with -DMM_PROFILE_SMALL or
+ * -DMM_PROFILE_LARGE (the mm-small.o / mm-large.o Makefile targets) to
+ * pre-set the policy knobs below for a known deployment and compile out
+ * the branches that workload never takes. Every variant stays correct
+ * for any request stream - off-profile sizes just lose the fast path.
+ * The generic build keeps the defaults; all knobs stay overridable on
+ * the command line through the #ifndef guards.
+ */
+#if defined(MM_PROFILE_SMALL) && defined(MM_PROFILE_LARGE)
+#error "MM_PROFILE_SMALL and MM_PROFILE_LARGE are mutually exclusive"
+#endif
+
+#ifdef MM_PROFILE_SMALL
+// node-allocator services: essentially every request is a few tens of
+// bytes. Deep exact-size caches absorb the whole mix, recycled blocks
+// always fit their bin exactly, so the split branch in place() is dead
+// and compiled out (MM_NO_SPLIT); extensions stay small to keep the
+// footprint tight.
+#define TCACHE_SLOTS 64
+#define MM_NO_SPLIT
+#endif
+
+#ifdef MM_PROFILE_LARGE
+// buffer services: requests run from kilobytes to megabytes. Exact-size
+// recycling essentially never hits at those sizes, so the tcache is
+// compiled out (TCACHE_SLOTS 0) and every free coalesces immediately,
+// while much larger extension bounds cut the sbrk count on the ramp.
+#define TCACHE_SLOTS 0
+#define EXTEND_SIZE (1 << 16)
+#define MAX_EXTEND (1 << 22)
+#endif
+
 /* What is the correct alignment? */
 #define ALIGNMENT 16
 #define HEADER_SIZE 8
 #define FOOTER_SIZE 8
 #define MIN_BLOCK_SIZE 32
+#ifndef EXTEND_SIZE
 #define EXTEND_SIZE 4096
+#endif
+// heap extensions grow geometrically with the heap (one eighth of the
+// current size), bounded below by EXTEND_SIZE and above by MAX_EXTEND,
+// so ramping workloads need O(log n) sbrk calls instead of O(n)
+#ifndef MAX_EXTEND
+#define MAX_EXTEND (1 << 18)
+#endif
+#ifndef SEG_LIST_SIZE
 #define SEG_LIST_SIZE 14
+#endif
+
+// the size classes of the segregated list are consecutive powers of two:
+// class k (k >= 1) covers sizes in [2^(SEG_CLASS_SHIFT+k-1), 2^(SEG_CLASS_SHIFT+k)),
+// class 0 holds anything smaller and the last class holds everything larger.
+// Retuning the classes only means changing these two constants.
+#ifndef SEG_CLASS_SHIFT
+#define SEG_CLASS_SHIFT 5
+#endif
+
+// small blocks get exact-size bins, one per ALIGNMENT increment, so
+// allocation is pop-head and free is push-head with no list scan
+#ifndef SMALL_BIN_MAX
+#define SMALL_BIN_MAX 256
+#endif
+#define SMALL_BIN_COUNT ((SMALL_BIN_MAX - MIN_BLOCK_SIZE) / ALIGNMENT + 1)
+
+// free blocks of at least this size are indexed by a size-keyed tree
+// embedded in the blocks themselves, instead of the segregated lists.
+// Starting the tree right above the exact small bins makes every
+// non-exact allocation a guaranteed best fit: the tree holds one node
+// per distinct size with equal sizes chained behind it, so lookups and
+// inserts cost the depth of a tree of distinct sizes, not a list scan.
+// The segregated lists then only index sizes in a gap left by retuning
+// SMALL_BIN_MAX below this threshold.
+#define LARGE_TREE_MIN (SMALL_BIN_MAX + ALIGNMENT)
+
+// number of recently freed blocks each exact-size cache bin may hold;
+// cached blocks stay marked allocated and bypass coalescing entirely.
+// 0 compiles the cache out.
+#ifndef TCACHE_SLOTS
+#define TCACHE_SLOTS 8
+#endif
 
-// size class of the segregated list
-#define seg_size_class1 32
-#define seg_size_class2 64
-#define seg_size_class3 128
-#define seg_size_class4 256
-#define seg_size_class5 512
-#define seg_size_class6 1024
-#define seg_size_class7 2048
-#define seg_size_class8 4096
-#define seg_size_class9 8192
-#define seg_size_class10 16384
-#define seg_size_class11 32768
-#define seg_size_class12 65536
-#define seg_size_class13 131072
+/*
+ * Deferred coalescing: compile with -DMM_DEFER_COALESCE to make free()
+ * just push blocks onto their bins. Merging then happens as a single
+ * batched sweep over the heap, triggered when an allocation misses the
+ * free structures or after MM_DEFER_THRESHOLD deferred frees. This
+ * trades some utilization for much cheaper burst frees.
+ */
+#ifdef MM_DEFER_COALESCE
+#ifndef MM_DEFER_THRESHOLD
+#define MM_DEFER_THRESHOLD 4096
+#endif
+// a miss-triggered sweep only runs once this many frees have accumulated,
+// so the cost of the heap walk is amortized over a real batch
+#ifndef MM_DEFER_MIN_BATCH
+#define MM_DEFER_MIN_BATCH 64
+#endif
+#endif /* MM_DEFER_COALESCE */
 
 typedef void *blk_ptr;
 
@@ -85,6 +187,9 @@ static size_t min(size_t x, size_t y){ return ((x < y) ? (x) : (y));}
 // pack the size and the allocated bit into a word
 static size_t pack(size_t size, int alloc){return ((size) | (alloc));}
 
+// pack the size, the allocated bit and the previous-allocated bit into a word
+static size_t pack_prev(size_t size, int alloc, size_t prev_alloc){return ((size) | (alloc) | ((prev_alloc) << 1));}
+
 // read and write at the address of bp
 static size_t get(blk_ptr bp){return (*(size_t *)(bp));}
 static void put(blk_ptr bp, size_t val){*((size_t *)(bp)) = val;}
@@ -98,11 +203,20 @@ static size_t get_size(blk_ptr bp){return (size_t)(get(bp) & ~(0xf));}
 // return the allocated bit given bp
 static size_t get_alloc(blk_ptr bp){return (size_t)(get(bp) & 0x1);}
 
+// return the previous-allocated bit given a header pointer
+static size_t get_prev_alloc(blk_ptr hp){return (size_t)((get(hp) >> 1) & 0x1);}
+
+// set and clear the previous-allocated bit given a header pointer
+static void set_prev_alloc(blk_ptr hp){put(hp, get(hp) | 0x2);}
+static void clear_prev_alloc(blk_ptr hp){put(hp, get(hp) & ~(size_t)0x2);}
+
 // compute the address of header and footer given bp
 static size_t *p_to_header(void *bp){return ((size_t *)(bp) - 1);}
 static size_t *p_to_footer(void *bp){return ((size_t *)((bp) + get_size(p_to_header(bp)) - 16));}
 
 // compute the address of previous and next block given bp
+// prev_bp is only valid when the previous block is free, since only
+// free blocks carry a footer
 static size_t *prev_bp(blk_ptr bp){return (size_t *)((bp) - get_size((bp) - 16));}
 static size_t *next_bp(blk_ptr bp){return (size_t *)((bp) + get_size(p_to_header(bp)));}
 
@@ -114,45 +228,230 @@ static size_t *next_freebp(blk_ptr bp){return ((size_t *)((bp) + 8));}
 static size_t *prev_listbp(blk_ptr bp){return (*(size_t **)(bp));}
 static size_t *next_listbp(blk_ptr bp){return (*(size_t **)(next_freebp(bp)));}
 
-// declare segregated list array and heap pointer
-blk_ptr seg_list[SEG_LIST_SIZE];
+// large free blocks double as tree nodes: the child and parent links
+// live behind the list links, and blocks of equal size chain through
+// the ordinary prev/next free pointers with only the head in the tree
+static size_t *left_slot(blk_ptr bp){return ((size_t *)((bp) + 16));}
+static size_t *right_slot(blk_ptr bp){return ((size_t *)((bp) + 24));}
+static size_t *parent_slot(blk_ptr bp){return ((size_t *)((bp) + 32));}
+static size_t *left_treebp(blk_ptr bp){return (*(size_t **)(left_slot(bp)));}
+static size_t *right_treebp(blk_ptr bp){return (*(size_t **)(right_slot(bp)));}
+static size_t *parent_treebp(blk_ptr bp){return (*(size_t **)(parent_slot(bp)));}
+
+// free nodes cache their size behind the links, so fit scans compare
+// sizes from the cache line the links already brought in instead of
+// loading the header 8 bytes before the node. List nodes keep it where
+// tree children would live; tree nodes keep it behind the parent link.
+// The cache is written at insert and blocks never resize while listed.
+static size_t *list_size_slot(blk_ptr bp){return ((size_t *)((bp) + 16));}
+static size_t *tree_size_slot(blk_ptr bp){return ((size_t *)((bp) + 40));}
+
+#if LARGE_TREE_MIN < 56
+#error "LARGE_TREE_MIN must leave room for the tree links and the cached size"
+#endif
+
+// per-arena allocator state: segregated list array, exact-size small
+// bins and the large-block tree root. The default build has a single
+// arena that every call operates on.
+struct arena {
+	blk_ptr seg_list[SEG_LIST_SIZE];
+	blk_ptr small_bins[SMALL_BIN_COUNT];
+	blk_ptr large_tree_root;
+	// the retained chunk at the top of the most recent extension; it is
+	// free but lives outside every list, and malloc carves from it
+	// directly when the free structures come up empty
+	blk_ptr top_chunk;
+	// per-exact-size stacks of very recently freed small blocks, linked
+	// through their first payload word and still marked allocated, so a
+	// free-then-malloc of the same size is a push and a pop
+	blk_ptr tcache[SMALL_BIN_COUNT];
+	size_t tcache_count[SMALL_BIN_COUNT];
+	size_t tcache_total;
+#ifdef MM_DEFER_COALESCE
+	// number of frees whose coalescing is still pending
+	size_t deferred_free_count;
+#endif
+#ifdef MM_ARENAS
+	pthread_mutex_t lock;
+	// stack of blocks freed by threads pinned to other arenas,
+	// linked through their first payload word
+	blk_ptr remote_frees;
+#endif
+};
+
+static struct arena arenas[MM_ARENA_COUNT];
 blk_ptr heap_list_ptr = NULL;
 
+#ifdef MM_ARENAS
+// serializes heap extension across arenas
+static pthread_mutex_t sbrk_lock = PTHREAD_MUTEX_INITIALIZER;
+// the arena all internal helpers operate on; set at every API entry
+static __thread struct arena *cur_arena = NULL;
+// the arena this thread is pinned to
+static __thread struct arena *my_arena = NULL;
+
+// function that pins the calling thread to an arena by thread id hash
+static struct arena *arena_for_thread(void){
+	if(my_arena == NULL){
+		size_t tid = (size_t)pthread_self();
+		my_arena = &arenas[(tid ^ (tid >> 12)) % MM_ARENA_COUNT];
+	}
+	return my_arena;
+}
+#else
+static struct arena *cur_arena = &arenas[0];
+#endif /* MM_ARENAS */
+
+// one past the highest heap byte that may hold nonzero data, not
+// counting the top chunk footer and the epilogue just below the break.
+// Everything at or above this mark is untouched anonymous mapping and
+// therefore zero, which lets calloc skip the memset for blocks carved
+// straight from fresh heap. The mark is monotonic across mm_init calls
+// on purpose: the driver resets the break between runs but reuses the
+// same mapping, so an earlier run's dirt stays below the old mark.
+#ifndef MM_ARENAS
+static char *touched_hi = NULL;
+#endif
+
+// raise the mark to cover a write ending at p. In arena mode segments
+// interleave below the break and the mark would race between arena
+// locks, so calloc always zeroes there and the mark stays unused.
+static void touch_raise(void *p){
+#ifndef MM_ARENAS
+	if((char *)p > touched_hi){
+		touched_hi = (char *)p;
+	}
+#else
+	(void)p;
+#endif
+}
+
+// the tag identifying the current arena, stored in bits 2-3 of every
+// allocated block header so free() can find the owner
+static size_t arena_tag(void){
+	return (size_t)(cur_arena - arenas) << 2;
+}
+
+// return the owning arena of an allocated block given its header
+static struct arena *get_owner(blk_ptr hp){
+	return &arenas[(get(hp) >> 2) & 0x3];
+}
+
+#ifdef MM_STATS
+// per-class and heap-level counters (see mm.h); plain unsynchronized
+// increments, shared across arenas
+static mm_bin_stats_t stat_bins[SEG_LIST_SIZE];
+static mm_heap_stats_t stat_heap;
+
+// record one free-list scan of the given class
+static void stats_scan(int seg_index, size_t steps){
+	stat_bins[seg_index].scans++;
+	stat_bins[seg_index].scan_steps += steps;
+	if(steps > stat_bins[seg_index].scan_max){
+		stat_bins[seg_index].scan_max = steps;
+	}
+}
+#endif /* MM_STATS */
+
 static blk_ptr extend_heap(size_t size);
 static blk_ptr coalesce(void *ptr);
 static blk_ptr place(void* ptr, size_t asize);
 static void delete_list_blcok(void *ptr);
 static void add_list_block(void *ptr, size_t size);
 static int search_seg_list(size_t asize);
+#if TCACHE_SLOTS > 0
+static void tcache_flush(void);
+#endif
+static void check_op(blk_ptr bp);
+static size_t trim_limit(void);
+static void trim_decommit(blk_ptr bp, size_t size);
+static void trim_top(void);
 int mm_check(char *function);
 
 // function that extends the heap and create free blocks
 static blk_ptr extend_heap(size_t wsize){
 	size_t asize = align(wsize);
 	size_t *bp;
-	
+
+#ifdef MM_ARENAS
+	// each extension is a self-contained segment: the memory just below
+	// the break may belong to another arena, so the new block starts
+	// behind 16 bytes of padding (keeping payload alignment) and claims
+	// its predecessor is allocated, and ends with its own epilogue
+	pthread_mutex_lock(&sbrk_lock);
+	bp = mem_sbrk(asize + 2*HEADER_SIZE);
+	pthread_mutex_unlock(&sbrk_lock);
+	if(bp == (void *)-1){
+		return NULL;
+	}
+	bp = (size_t *)((void *)bp + 2*HEADER_SIZE);
+
+#ifdef MM_STATS
+	stat_heap.sbrk_calls++;
+	stat_heap.sbrk_bytes += asize + 2*HEADER_SIZE;
+#endif
+
+	// the old top chunk is in another segment now; release it to the
+	// free lists and retain the new extension instead
+	if(cur_arena->top_chunk != NULL){
+		add_list_block(cur_arena->top_chunk, get_size(p_to_header(cur_arena->top_chunk)));
+	}
+
+	put(p_to_header(bp), pack_prev(asize, 0, 1));
+	put(p_to_footer(bp), pack(asize, 0));
+	put(p_to_header(next_bp(bp)), pack(0,1));
+	cur_arena->top_chunk = bp;
+	return bp;
+#else
 	if((size_t *)(bp = mem_sbrk(asize)) == (void *)-1){
 		return NULL;
 	}
-	
-	// add to segregated list
-	add_list_block(bp,asize);
-	
+
+#ifdef MM_STATS
+	stat_heap.sbrk_calls++;
+	stat_heap.sbrk_bytes += asize;
+#endif
+
+	// the stale footer and epilogue just below the old break become
+	// interior bytes of the extended block; count them as dirty
+	touch_raise(bp);
+
+	// the old epilogue header becomes the new block header, so its
+	// previous-allocated bit carries over to the new free block
+	size_t prev_alloc = get_prev_alloc(p_to_header(bp));
+
+	// absorb the free block just below the extension — usually the
+	// retained top chunk, which delete_list_blcok knows how to release
+	if(!prev_alloc){
+		blk_ptr prevb = prev_bp(bp);
+		delete_list_blcok(prevb);
+		asize += get_size(p_to_header(prevb));
+		prev_alloc = get_prev_alloc(p_to_header(prevb));
+		bp = (size_t *)prevb;
+	}
+
 	// set free block header and footer and epilogue header
-	put(p_to_header(bp), pack(asize, 0));
+	// the new epilogue follows a free block, so its prev-alloc bit is clear
+	put(p_to_header(bp), pack_prev(asize, 0, prev_alloc));
 	put(p_to_footer(bp), pack(asize, 0));
 	put(p_to_header(next_bp(bp)), pack(0,1));
-	return coalesce(bp);
+
+	// the extension is retained as the top chunk rather than listed
+	cur_arena->top_chunk = bp;
+	return bp;
+#endif /* MM_ARENAS */
 }
 
 // function that combines adjacent free blocks into one larger free block
 // and remove the appropriate free blocks from the list
 static blk_ptr coalesce(void *bp){
 	// maintain information of previous and next block
-	size_t prev_alloc = get_alloc(p_to_header(prev_bp(bp)));
+	// the previous block's state comes from our own header bit, since an
+	// allocated previous block has no footer to look at
+	size_t prev_alloc = get_prev_alloc(p_to_header(bp));
 	size_t next_alloc = get_alloc(p_to_header(next_bp(bp)));
 	size_t size = get_size(p_to_header(bp));
-	
+
 	// case that previous and next block allocated return current bp
 	if(prev_alloc && next_alloc){
 		return bp;
@@ -166,9 +465,9 @@ static blk_ptr coalesce(void *bp){
 		delete_list_blcok(bp);
 		delete_list_blcok(prev_bp(bp));
 
-		// update block info 
+		// update block info, keeping the previous block's prev-alloc bit
 		put(p_to_footer(bp),pack(size,0));
-		put(p_to_header(prev_bp(bp)),pack(size,0));
+		put(p_to_header(prev_bp(bp)),pack_prev(size,0,get_prev_alloc(p_to_header(prev_bp(bp)))));
 		bp = prev_bp(bp);
 	}
 	// next block is free
@@ -180,8 +479,8 @@ static blk_ptr coalesce(void *bp){
 		delete_list_blcok(bp);
 		delete_list_blcok(next_bp(bp));
 
-		// update block info 
-		put(p_to_header(bp),pack(size, 0));
+		// update block info
+		put(p_to_header(bp),pack_prev(size, 0, 1));
 		put(p_to_footer(bp),pack(size, 0));
 	}
 	// both of previous and next blocks are free
@@ -194,34 +493,293 @@ static blk_ptr coalesce(void *bp){
 		delete_list_blcok(next_bp(bp));
 		delete_list_blcok(prev_bp(bp));
 
-		// update block info
+		// update block info, keeping the previous block's prev-alloc bit
+		size_t prev_prev_alloc = get_prev_alloc(p_to_header(prev_bp(bp)));
 		put(p_to_footer(next_bp(bp)),pack(size,0));
-		put(p_to_header(prev_bp(bp)),pack(size,0));
+		put(p_to_header(prev_bp(bp)),pack_prev(size,0,prev_prev_alloc));
 		bp = prev_bp(bp);
 	}
 
+#ifdef MM_STATS
+	stat_bins[search_seg_list(size)].coalesces++;
+#endif
+
 	// add new free block to seg list
 	add_list_block(bp,size);
 	return bp;
 }
 
-// function that search the segregated list to find the appropriate size class
-// and return the size class index of the segregated list
+// function that computes the appropriate size class in constant time
+// and return the size class index of the segregated list.
+// Since the class boundaries are powers of two, the index is just the
+// position of the highest set bit, shifted and clamped to the table.
 static int search_seg_list(size_t size){
-	if(size < seg_size_class1)	return 0;
-	else if((size >= seg_size_class1) && (size < seg_size_class2))	return 1;
-	else if((size >= seg_size_class2) && (size < seg_size_class3))	return 2;
-	else if((size >= seg_size_class3) && (size < seg_size_class4))	return 3;
-	else if((size >= seg_size_class4) && (size < seg_size_class5))	return 4;
-	else if((size >= seg_size_class5) && (size < seg_size_class6))	return 5;
-	else if((size >= seg_size_class6) && (size < seg_size_class7))	return 6;
-	else if((size >= seg_size_class7) && (size < seg_size_class8))	return 7;
-	else if((size >= seg_size_class8) && (size < seg_size_class9))	return 8;
-	else if((size >= seg_size_class9) && (size < seg_size_class10))	return 9;
-	else if((size >= seg_size_class10) && (size < seg_size_class11))	return 10;
-	else if((size >= seg_size_class11) && (size < seg_size_class12))	return 11;
-	else if((size >= seg_size_class12) && (size < seg_size_class13))	return 12;
-	else	return 13;
+	if(size < ((size_t)1 << SEG_CLASS_SHIFT)){
+		return 0;
+	}
+	int seg_index = (63 - __builtin_clzll(size)) - SEG_CLASS_SHIFT + 1;
+	return (seg_index < SEG_LIST_SIZE - 1) ? seg_index : SEG_LIST_SIZE - 1;
+}
+
+// function that computes the exact-size bin index of a small block
+static int small_bin_index(size_t size){
+	return (int)((size - MIN_BLOCK_SIZE) / ALIGNMENT);
+}
+
+// function that returns the list head slot a free block of the given
+// size belongs to: an exact small bin, or its segregated size class
+static blk_ptr *list_head_for(size_t size){
+	if(size <= SMALL_BIN_MAX){
+		return &cur_arena->small_bins[small_bin_index(size)];
+	}
+	return &cur_arena->seg_list[search_seg_list(size)];
+}
+
+// function that replaces the tree node old_bp with new_bp in old_bp's
+// parent (or at the root), without touching old_bp's children
+static void tree_transplant(blk_ptr old_bp, blk_ptr new_bp){
+	blk_ptr parent = parent_treebp(old_bp);
+	if(parent == NULL){
+		cur_arena->large_tree_root = new_bp;
+	}
+	else if(left_treebp(parent) == old_bp){
+		putptr(left_slot(parent), new_bp);
+	}
+	else{
+		putptr(right_slot(parent), new_bp);
+	}
+	if(new_bp != NULL){
+		putptr(parent_slot(new_bp), parent);
+	}
+}
+
+// function that inserts a large free block into the size-keyed tree;
+// blocks of equal size chain behind the tree node through the free links
+static void tree_add_block(blk_ptr bp, size_t size){
+	putptr(prev_freebp(bp), NULL);
+	putptr(next_freebp(bp), NULL);
+	putptr(left_slot(bp), NULL);
+	putptr(right_slot(bp), NULL);
+	putptr(parent_slot(bp), NULL);
+	put(tree_size_slot(bp), size);
+
+	if(cur_arena->large_tree_root == NULL){
+		cur_arena->large_tree_root = bp;
+		return;
+	}
+
+	blk_ptr curr = cur_arena->large_tree_root;
+	while(true){
+		// overlap the next level's miss with this node's compare
+		__builtin_prefetch(left_treebp(curr));
+		__builtin_prefetch(right_treebp(curr));
+		size_t csize = get(tree_size_slot(curr));
+		if(size == csize){
+			// chain behind the existing node of the same size
+			blk_ptr chain = next_listbp(curr);
+			putptr(next_freebp(bp), chain);
+			putptr(prev_freebp(bp), curr);
+			if(chain != NULL){
+				putptr(prev_freebp(chain), bp);
+			}
+			putptr(next_freebp(curr), bp);
+			return;
+		}
+		if(size < csize){
+			if(left_treebp(curr) == NULL){
+				putptr(left_slot(curr), bp);
+				putptr(parent_slot(bp), curr);
+				return;
+			}
+			curr = left_treebp(curr);
+		}
+		else{
+			if(right_treebp(curr) == NULL){
+				putptr(right_slot(curr), bp);
+				putptr(parent_slot(bp), curr);
+				return;
+			}
+			curr = right_treebp(curr);
+		}
+	}
+}
+
+// function that removes a large free block from the tree or its chain
+static void tree_delete_block(blk_ptr bp){
+	// chained duplicate: plain doubly-linked unlink
+	if(prev_listbp(bp) != NULL){
+		putptr(next_freebp(prev_listbp(bp)), next_listbp(bp));
+		if(next_listbp(bp) != NULL){
+			putptr(prev_freebp(next_listbp(bp)), prev_listbp(bp));
+		}
+		return;
+	}
+
+	// tree node with a chained duplicate: promote the duplicate in place
+	blk_ptr dup = next_listbp(bp);
+	if(dup != NULL){
+		putptr(prev_freebp(dup), NULL);
+		putptr(left_slot(dup), left_treebp(bp));
+		putptr(right_slot(dup), right_treebp(bp));
+		if(left_treebp(bp) != NULL){
+			putptr(parent_slot(left_treebp(bp)), dup);
+		}
+		if(right_treebp(bp) != NULL){
+			putptr(parent_slot(right_treebp(bp)), dup);
+		}
+		tree_transplant(bp, dup);
+		return;
+	}
+
+	// ordinary binary search tree removal
+	if(left_treebp(bp) == NULL){
+		tree_transplant(bp, right_treebp(bp));
+	}
+	else if(right_treebp(bp) == NULL){
+		tree_transplant(bp, left_treebp(bp));
+	}
+	else{
+		// splice in the successor, the smallest node of the right subtree
+		blk_ptr succ = right_treebp(bp);
+		while(left_treebp(succ) != NULL){
+			succ = left_treebp(succ);
+		}
+		if(parent_treebp(succ) != bp){
+			tree_transplant(succ, right_treebp(succ));
+			putptr(right_slot(succ), right_treebp(bp));
+			putptr(parent_slot(right_treebp(bp)), succ);
+		}
+		tree_transplant(bp, succ);
+		putptr(left_slot(succ), left_treebp(bp));
+		putptr(parent_slot(left_treebp(bp)), succ);
+	}
+}
+
+// function that finds the best-fitting large free block: the tree node
+// with the smallest size that still covers asize
+static blk_ptr tree_find_fit(size_t asize){
+	blk_ptr best = NULL;
+	blk_ptr curr = cur_arena->large_tree_root;
+	while(curr != NULL){
+		// overlap the next level's miss with this node's compare
+		__builtin_prefetch(left_treebp(curr));
+		__builtin_prefetch(right_treebp(curr));
+		size_t csize = get(tree_size_slot(curr));
+		if(csize == asize){
+			return curr;
+		}
+		if(csize < asize){
+			curr = right_treebp(curr);
+		}
+		else{
+			best = curr;
+			curr = left_treebp(curr);
+		}
+	}
+	return best;
+}
+
+// function that searches the free structures for a block that fits:
+// a best-fit scan of the matching size class (whose list is kept in
+// ascending size order, so the first fit is the best fit), then the
+// head of the next non-empty class — its smallest block, which always
+// fits — then the large-block tree
+static blk_ptr find_fit(size_t asize){
+	if(asize >= LARGE_TREE_MIN){
+		return tree_find_fit(asize);
+	}
+
+	int seg_index = search_seg_list(asize);
+	blk_ptr bp = cur_arena->seg_list[seg_index];
+	int i;
+	for(i = 0; bp != NULL; i++){
+		__builtin_prefetch(next_listbp(bp));
+		if(asize <= get(list_size_slot(bp))){
+#ifdef MM_STATS
+			stats_scan(seg_index, (size_t)i + 1);
+#endif
+			return bp;
+		}
+		bp = next_listbp(bp);
+	}
+#ifdef MM_STATS
+	stats_scan(seg_index, (size_t)i);
+#endif
+
+	// fall through the larger size classes, whose blocks always fit;
+	// the ordered lists make each head the tightest fit of its class
+	for(seg_index++; seg_index < SEG_LIST_SIZE; seg_index++){
+		if(cur_arena->seg_list[seg_index] != NULL){
+			return cur_arena->seg_list[seg_index];
+		}
+	}
+
+	// no listed block fits; try the large-block tree
+	return tree_find_fit(asize);
+}
+
+#ifdef MM_DEFER_COALESCE
+// function that merges every run of adjacent free blocks in one pass
+// over the heap, settling all deferred frees at once
+static void coalesce_sweep(void){
+	blk_ptr bp = mem_heap_lo() + 2*HEADER_SIZE;
+	size_t size;
+
+	while((size = get_size(p_to_header(bp))) != 0){
+		if(get_alloc(p_to_header(bp))){
+			bp = next_bp(bp);
+			continue;
+		}
+
+		// merge the whole run of free blocks starting at bp
+		bool merged = false;
+		blk_ptr next = next_bp(bp);
+		while(!get_alloc(p_to_header(next))){
+			if(!merged){
+				delete_list_blcok(bp);
+				merged = true;
+			}
+			size_t nsize = get_size(p_to_header(next));
+			delete_list_blcok(next);
+			size += nsize;
+			next = next + nsize;
+		}
+
+		if(merged){
+			put(p_to_header(bp), pack_prev(size, 0, get_prev_alloc(p_to_header(bp))));
+			put(p_to_footer(bp), pack(size, 0));
+			add_list_block(bp, size);
+		}
+		bp = next;
+	}
+
+	cur_arena->deferred_free_count = 0;
+
+	// the sweep may have merged a large region against the break
+	trim_top();
+}
+#endif /* MM_DEFER_COALESCE */
+
+// function that carves an allocation off the bottom of the retained
+// top chunk, leaving the remainder as the new top chunk
+static blk_ptr carve_top(size_t asize){
+	blk_ptr bp = cur_arena->top_chunk;
+	size_t csize = get_size(p_to_header(bp));
+	size_t prev_alloc = get_prev_alloc(p_to_header(bp));
+
+	if((csize - asize) >= MIN_BLOCK_SIZE){
+		put(p_to_header(bp), pack_prev(asize, 1, prev_alloc) | arena_tag());
+		blk_ptr rest = next_bp(bp);
+		put(p_to_header(rest), pack_prev(csize-asize, 0, 1));
+		put(p_to_footer(rest), pack(csize-asize, 0));
+		cur_arena->top_chunk = rest;
+	}
+	else{
+		put(p_to_header(bp), pack_prev(csize, 1, prev_alloc) | arena_tag());
+		set_prev_alloc(p_to_header(next_bp(bp)));
+		cur_arena->top_chunk = NULL;
+	}
+	return bp;
 }
 
 // function that place the requested block into free block
@@ -233,26 +791,103 @@ static blk_ptr place(blk_ptr bp, size_t asize){
 	delete_list_blcok(bp);
 
 	size_t csize = get_size(p_to_header(bp));
-	size_t *next_block;
+	size_t prev_alloc = get_prev_alloc(p_to_header(bp));
 
+#ifndef MM_NO_SPLIT
 	// compare the remaining block size to the min free block size
 	// if large than or equal to the min free block size, then split the block
+	// allocated blocks carry no footer, only the header with the prev-alloc bit
 	if((csize - asize) >= (MIN_BLOCK_SIZE)){
-		put(p_to_header(bp), pack(asize,1));
-		put(p_to_footer(bp), pack(asize,1));
-		next_block = next_bp(bp);
-		put(p_to_header(next_bp(bp)), pack(csize-asize,0));
+#ifdef MM_STATS
+		stat_bins[search_seg_list(csize)].splits++;
+#endif
+		put(p_to_header(bp), pack_prev(asize,1,prev_alloc) | arena_tag());
+		put(p_to_header(next_bp(bp)), pack_prev(csize-asize,0,1));
 		put(p_to_footer(next_bp(bp)), pack(csize-asize,0));
 		add_list_block(next_bp(bp), csize-asize);
+		return bp;
+	}
+#endif
+
+	// the remaining size is not larger than min block size (or splitting
+	// is compiled out), so assign the whole free block to allocated
+	put(p_to_header(bp), pack_prev(csize, 1, prev_alloc) | arena_tag());
+	set_prev_alloc(p_to_header(next_bp(bp)));
+	return bp;
+}
+
+// function that computes the byte offset from bp to the first payload
+// position with the requested alignment, stepping one alignment
+// further when the prefix is too small to stand alone as a free block
+static size_t aligned_prefix(blk_ptr bp, size_t alignment){
+	size_t prefix = (alignment - ((size_t)bp & (alignment - 1))) & (alignment - 1);
+	if(prefix != 0 && prefix < MIN_BLOCK_SIZE){
+		prefix += alignment;
 	}
+	return prefix;
+}
 
-	// if the remaining size is not larger than min block size, 
-	// then assign free block to allocated
+// function that places an aligned allocation inside the delisted free
+// block bp: the misaligned prefix goes back onto the free list as its
+// own block, the aligned portion is allocated, and a sufficient tail
+// is split off just like place() does
+static blk_ptr place_aligned(blk_ptr bp, size_t asize, size_t prefix){
+	size_t csize = get_size(p_to_header(bp));
+	size_t prev_alloc = get_prev_alloc(p_to_header(bp));
+
+	if(prefix != 0){
+		// the block below a listed block is always allocated, so the
+		// prefix keeps the coalescing invariant on both sides
+		put(p_to_header(bp), pack_prev(prefix, 0, prev_alloc));
+		put(p_to_footer(bp), pack(prefix, 0));
+		add_list_block(bp, prefix);
+		bp = (blk_ptr)((char *)bp + prefix);
+		csize -= prefix;
+		prev_alloc = 0;
+	}
+
+	if((csize - asize) >= MIN_BLOCK_SIZE){
+		put(p_to_header(bp), pack_prev(asize, 1, prev_alloc) | arena_tag());
+		blk_ptr tail = next_bp(bp);
+		put(p_to_header(tail), pack_prev(csize-asize, 0, 1));
+		put(p_to_footer(tail), pack(csize-asize, 0));
+		add_list_block(tail, csize-asize);
+	}
+	else{
+		put(p_to_header(bp), pack_prev(csize, 1, prev_alloc) | arena_tag());
+		set_prev_alloc(p_to_header(next_bp(bp)));
+	}
+	return bp;
+}
+
+// function that carves an aligned allocation off the retained top
+// chunk, listing the misaligned prefix and keeping the tail as the
+// new top chunk
+static blk_ptr carve_top_aligned(size_t asize, size_t prefix){
+	blk_ptr bp = cur_arena->top_chunk;
+	size_t csize = get_size(p_to_header(bp));
+	size_t prev_alloc = get_prev_alloc(p_to_header(bp));
+
+	if(prefix != 0){
+		put(p_to_header(bp), pack_prev(prefix, 0, prev_alloc));
+		put(p_to_footer(bp), pack(prefix, 0));
+		add_list_block(bp, prefix);
+		bp = (blk_ptr)((char *)bp + prefix);
+		csize -= prefix;
+		prev_alloc = 0;
+	}
+
+	if((csize - asize) >= MIN_BLOCK_SIZE){
+		put(p_to_header(bp), pack_prev(asize, 1, prev_alloc) | arena_tag());
+		blk_ptr rest = next_bp(bp);
+		put(p_to_header(rest), pack_prev(csize-asize, 0, 1));
+		put(p_to_footer(rest), pack(csize-asize, 0));
+		cur_arena->top_chunk = rest;
+	}
 	else{
-		put(p_to_header(bp), pack(csize, 1));
-		put(p_to_footer(bp), pack(csize, 1));
-		if (!get_alloc(p_to_header(next_block)))
-			put(p_to_footer(next_block), get(p_to_header(next_block)));
+		put(p_to_header(bp), pack_prev(csize, 1, prev_alloc) | arena_tag());
+		set_prev_alloc(p_to_header(next_bp(bp)));
+		cur_arena->top_chunk = NULL;
 	}
 	return bp;
 }
@@ -260,20 +895,32 @@ static blk_ptr place(blk_ptr bp, size_t asize){
 // function that remove the block from the segregated list given
 // pointer and fix the the pointers
 static void delete_list_blcok(blk_ptr bp){
+	// the retained top chunk lives outside every list
+	if(bp == cur_arena->top_chunk){
+		cur_arena->top_chunk = NULL;
+		return;
+	}
+
 	// get block size info
 	size_t size = get_size(p_to_header(bp));
 
-	// search for size class index
-	int seg_index = search_seg_list(size);
-	
+	// large blocks live in the size-keyed tree
+	if(size >= LARGE_TREE_MIN){
+		tree_delete_block(bp);
+		return;
+	}
+
+	// find the list the block lives in
+	blk_ptr *head = list_head_for(size);
+
 	if(prev_listbp(bp) == NULL){
-		// update previous free block pointer 
+		// update previous free block pointer
 		if(next_listbp(bp) != NULL){
 			putptr(prev_freebp(next_listbp(bp)), NULL);
-			seg_list[seg_index] = next_listbp(bp);
+			*head = next_listbp(bp);
 		}
 		else{
-			seg_list[seg_index] = NULL;
+			*head = NULL;
 		}
 
 	}
@@ -292,30 +939,65 @@ static void delete_list_blcok(blk_ptr bp){
 
 }
 
-// function that insert the free block into segregated list
+// function that insert the free block into its exact small bin or
+// segregated list, always at the head
 static void add_list_block(blk_ptr bp, size_t size){
-	// find the appropirate size class list
-    int seg_index = search_seg_list(size);
-
-	// set head of the size class list
-    void *curr_head_ptr = curr_head_ptr = seg_list[seg_index]; 
-
- // case that no blocks in the size list
-    if (curr_head_ptr != NULL) { 
-		// set bp to list head and update the previous and next block info
-		seg_list[seg_index] = bp;
-        putptr(prev_freebp(bp), NULL);
-        putptr(next_freebp(bp), curr_head_ptr);
-        putptr(prev_freebp(curr_head_ptr), bp);
-        
-    }
-	// case that there are blocks in the size list
-    else { 
-		// set bp to the list head and set previous and next free block to NULL
-		seg_list[seg_index] = bp;
+	// a listed block carries links and a footer anywhere in its extent,
+	// and may later be handed out whole, so its entire span is dirty
+	touch_raise((char *)bp - HEADER_SIZE + size);
+
+	// trimming policy: past the threshold a block's interior pages go
+	// back to the OS while the block itself stays listed (see trim_top)
+	size_t tlimit = trim_limit();
+	if(tlimit != 0 && size >= tlimit){
+		trim_decommit(bp, size);
+	}
+
+	// large blocks live in the size-keyed tree
+	if(size >= LARGE_TREE_MIN){
+		tree_add_block(bp, size);
+		return;
+	}
+
+	// find the appropirate list head
+	blk_ptr *head = list_head_for(size);
+
+	// exact small bins hold a single size, so pushing at the head is
+	// free and the order carries no information
+	if(size <= SMALL_BIN_MAX){
+		void *curr_head_ptr = *head;
+		*head = bp;
 		putptr(prev_freebp(bp), NULL);
-        putptr(next_freebp(bp), NULL);  
-    }
+		putptr(next_freebp(bp), curr_head_ptr);
+		if(curr_head_ptr != NULL){
+			putptr(prev_freebp(curr_head_ptr), bp);
+		}
+		return;
+	}
+
+	// seg lists are kept ascending by size: the first fitting block in
+	// a scan is then the best fit, and the head of any larger class is
+	// its smallest block, so the fallback's O(1) pick is the tightest
+	// guaranteed fit rather than whatever was freed last
+	put(list_size_slot(bp), size);
+	blk_ptr prev = NULL;
+	blk_ptr curr = *head;
+	while(curr != NULL && get(list_size_slot(curr)) < size){
+		__builtin_prefetch(next_listbp(curr));
+		prev = curr;
+		curr = next_listbp(curr);
+	}
+	putptr(prev_freebp(bp), prev);
+	putptr(next_freebp(bp), curr);
+	if(curr != NULL){
+		putptr(prev_freebp(curr), bp);
+	}
+	if(prev != NULL){
+		putptr(next_freebp(prev), bp);
+	}
+	else{
+		*head = bp;
+	}
 }
 
 
@@ -326,10 +1008,32 @@ static void add_list_block(blk_ptr bp, size_t size){
 // and create prologue and epilogue blocks
 bool mm_init(void)
 {
-	for(int i = 0; i < SEG_LIST_SIZE; i++){
-		seg_list[i] = NULL;
+#ifdef MM_ARENAS
+	cur_arena = arena_for_thread();
+#endif
+	mm_stats_reset();
+	for(int a = 0; a < MM_ARENA_COUNT; a++){
+		struct arena *ar = &arenas[a];
+		for(int i = 0; i < SEG_LIST_SIZE; i++){
+			ar->seg_list[i] = NULL;
+		}
+		for(int i = 0; i < SMALL_BIN_COUNT; i++){
+			ar->small_bins[i] = NULL;
+			ar->tcache[i] = NULL;
+			ar->tcache_count[i] = 0;
+		}
+		ar->large_tree_root = NULL;
+		ar->top_chunk = NULL;
+		ar->tcache_total = 0;
+#ifdef MM_DEFER_COALESCE
+		ar->deferred_free_count = 0;
+#endif
+#ifdef MM_ARENAS
+		pthread_mutex_init(&ar->lock, NULL);
+		ar->remote_frees = NULL;
+#endif
 	}
-		
+
 	// create the prologue and epilogue
 	if((heap_list_ptr = mem_sbrk(MIN_BLOCK_SIZE)) == NULL){
 		return false;
@@ -340,6 +1044,13 @@ bool mm_init(void)
 	put(heap_list_ptr + HEADER_SIZE, pack(2*HEADER_SIZE,1));
 	put(heap_list_ptr + (2*FOOTER_SIZE), pack(2*FOOTER_SIZE, 1));
 
+	// create the initial epilogue with the prev-alloc bit set,
+	// so the first extended block knows the prologue is allocated
+	put(heap_list_ptr + (3*HEADER_SIZE), pack_prev(0, 1, 1));
+
+	// the prologue and epilogue writes dirty the bottom of the heap
+	touch_raise((char *)heap_list_ptr + 4*HEADER_SIZE);
+
 	// create free blocks in the heap
 	if(extend_heap(EXTEND_SIZE) == NULL){
 		return false;
@@ -349,132 +1060,770 @@ bool mm_init(void)
 
 }
 
+/*
+ * Snapshot/restore of the allocator state (see mm.h), paired with
+ * mem_snapshot/mem_restore. All pointers in the arena structures point
+ * into the heap, which the memlib side restores byte-identically, so a
+ * plain struct copy is coherent. Single-threaded use only: arena-mode
+ * locks are copied along with everything else.
+ */
+static struct arena snap_arenas[MM_ARENA_COUNT];
+static blk_ptr snap_heap_list_ptr = NULL;
+
+void mm_snapshot(void)
+{
+	for(int a = 0; a < MM_ARENA_COUNT; a++){
+		snap_arenas[a] = arenas[a];
+	}
+	snap_heap_list_ptr = heap_list_ptr;
+}
+
+void mm_restore(void)
+{
+	for(int a = 0; a < MM_ARENA_COUNT; a++){
+		arenas[a] = snap_arenas[a];
+	}
+	heap_list_ptr = snap_heap_list_ptr;
+	// the touched mark is deliberately not restored: it is monotonic,
+	// and memory above the restored break may hold dirt written by a
+	// repetition that grew the heap further than the snapshot
+}
+
 /*
  * malloc: return a pointer to the payload of the allocated block
- * search the segregated list for free block and extend the heap if 
+ * search the segregated list for free block and extend the heap if
  * more blocks are required.
+ * In arena mode the public malloc/free/realloc wrappers take the arena
+ * lock and set cur_arena before calling these _block internals.
  */
-void* malloc(size_t size)
+static void* malloc_block(size_t size)
 {
 	blk_ptr bp = NULL;
 	size_t asize;
 	size_t extendsize;
-	int seg_index = 0;
-	
+
 	// check if size is valid
 	if(size == 0){
 		return NULL;
 	}
 	
-	// Modify block size to include header 
-	if(size <= HEADER_SIZE*2){
+	// Modify block size to include header only, since allocated
+	// blocks are footerless
+	if(size <= MIN_BLOCK_SIZE - HEADER_SIZE){
 		asize = MIN_BLOCK_SIZE;
 	}
 	// alignment request
 	else{
-		asize = align(size + HEADER_SIZE*2);
+		asize = align(size + HEADER_SIZE);
 	}
 
-	// find the right size class index
-	seg_index = search_seg_list(asize);
-	// decide extended size for heap
-	extendsize = max(asize, EXTEND_SIZE);
+#ifdef MM_STATS
+	stat_bins[search_seg_list(asize)].allocs++;
+#endif
 
-	// find the right spot to place the block
-	if(seg_index != SEG_LIST_SIZE){
-		bp = seg_list[seg_index];
+#if TCACHE_SLOTS > 0
+	// a recently freed block of this exact size is recycled as-is: its
+	// header is still valid and nothing else has to be touched
+	if(asize <= SMALL_BIN_MAX){
+		int ti = small_bin_index(asize);
+		bp = cur_arena->tcache[ti];
 		if(bp != NULL){
-			for(int i = 0; i < MIN_BLOCK_SIZE; i++){
-				if(bp == NULL){
-					break;
-				}
-				if(asize <= get_size(p_to_header(bp))){
-					place(bp,asize);
-					return bp;
-				}
-				bp = next_listbp(bp);
+			cur_arena->tcache[ti] = (blk_ptr)(*(size_t **)bp);
+			cur_arena->tcache_count[ti]--;
+			cur_arena->tcache_total--;
+			return bp;
+		}
+	}
+#endif
+
+	// small sizes hit the exact bins first: the head of the matching
+	// bin fits exactly, so this is a pop with no scan and no split.
+	// On a miss, the next non-empty bin is the best fit among small blocks.
+	if(asize <= SMALL_BIN_MAX){
+		for(int i = small_bin_index(asize); i < SMALL_BIN_COUNT; i++){
+			if(cur_arena->small_bins[i] != NULL){
+				return place(cur_arena->small_bins[i], asize);
 			}
 		}
 	}
 
-	seg_index++;
-	bp = NULL;
-	
-	// if there is no room in the list allocate more memory in heap by min block size
-	while((seg_index < SEG_LIST_SIZE) && (bp == NULL)){
-		bp = seg_list[seg_index];
-		seg_index++;
+	bp = find_fit(asize);
+
+#ifdef MM_DEFER_COALESCE
+	// an allocation miss settles the deferred frees and retries before
+	// growing the heap
+	if(bp == NULL && cur_arena->deferred_free_count >= MM_DEFER_MIN_BATCH){
+		coalesce_sweep();
+		bp = find_fit(asize);
 	}
-	
-	if(bp == NULL){
-		bp = extend_heap(extendsize);
+#endif
+
+	if(bp != NULL){
+		return place(bp,asize);
 	}
 
-	bp = place(bp,asize);
-	return bp;
+	// carve from the retained top chunk without touching the free lists
+	if(cur_arena->top_chunk != NULL &&
+			get_size(p_to_header(cur_arena->top_chunk)) >= asize){
+		return carve_top(asize);
+	}
+
+#if TCACHE_SLOTS > 0
+	// drain the cached blocks back to the lists and retry before the
+	// heap has to grow
+	if(cur_arena->tcache_total > 0){
+		tcache_flush();
+		bp = find_fit(asize);
+		if(bp != NULL){
+			return place(bp, asize);
+		}
+	}
+#endif
+
+	// decide extended size for heap: scale with the current heap size
+	// so steep allocation ramps need only O(log n) extensions
+	extendsize = max(asize, min(max(EXTEND_SIZE, mem_heapsize()/16), MAX_EXTEND));
+	if(extend_heap(extendsize) == NULL){
+		return NULL;
+	}
+	return carve_top(asize);
+}
+
+/*
+ * aligned_alloc: like malloc, but the payload address is a multiple of
+ * the requested power-of-two alignment. Candidate free blocks are
+ * tested for an aligned payload in their interior; the misaligned
+ * prefix is split back onto the free list instead of being wasted, so
+ * the block frees through the normal header path with no over-
+ * allocation slack.
+ */
+static void* aligned_alloc_block(size_t alignment, size_t size)
+{
+	blk_ptr bp;
+	size_t asize;
+	size_t prefix;
+
+	// reject non-power-of-two alignments; anything the base alignment
+	// already satisfies is a plain malloc
+	if(alignment == 0 || (alignment & (alignment - 1)) != 0){
+		return NULL;
+	}
+	if(alignment <= ALIGNMENT){
+		return malloc_block(size);
+	}
+	if(size == 0){
+		return NULL;
+	}
+
+	if(size <= MIN_BLOCK_SIZE - HEADER_SIZE){
+		asize = MIN_BLOCK_SIZE;
+	}
+	else{
+		asize = align(size + HEADER_SIZE);
+	}
+
+	// worst-case size that fits the payload behind any prefix: the
+	// prefix never exceeds alignment + ALIGNMENT
+	size_t wsize = asize + alignment + MIN_BLOCK_SIZE;
+
+	// search the seg lists the way find_fit does, but test every
+	// candidate for an aligned interior payload rather than raw size
+	for(int seg = search_seg_list(asize); seg < SEG_LIST_SIZE; seg++){
+		bp = cur_arena->seg_list[seg];
+		for(int i = 0; i < MIN_BLOCK_SIZE && bp != NULL; i++){
+			__builtin_prefetch(next_listbp(bp));
+			prefix = aligned_prefix(bp, alignment);
+			if(prefix + asize <= get(list_size_slot(bp))){
+				delete_list_blcok(bp);
+				return place_aligned(bp, asize, prefix);
+			}
+			bp = next_listbp(bp);
+		}
+	}
+
+	// the tree's best fit for the plain size may happen to align; a
+	// block of the worst-case size always does
+	bp = tree_find_fit(asize);
+	if(bp != NULL){
+		prefix = aligned_prefix(bp, alignment);
+		if(prefix + asize > get_size(p_to_header(bp))){
+			bp = tree_find_fit(wsize);
+		}
+	}
+	if(bp != NULL){
+		prefix = aligned_prefix(bp, alignment);
+		if(prefix + asize <= get_size(p_to_header(bp))){
+			delete_list_blcok(bp);
+			return place_aligned(bp, asize, prefix);
+		}
+	}
+
+	// carve from the retained top chunk when the aligned spot fits
+	if(cur_arena->top_chunk != NULL){
+		prefix = aligned_prefix(cur_arena->top_chunk, alignment);
+		if(prefix + asize <= get_size(p_to_header(cur_arena->top_chunk))){
+			return carve_top_aligned(asize, prefix);
+		}
+	}
+
+	// grow the heap by at least the worst-case size; the new top chunk
+	// is then guaranteed to contain an aligned payload
+	size_t extendsize = max(wsize, min(max(EXTEND_SIZE, mem_heapsize()/16), MAX_EXTEND));
+	if(extend_heap(extendsize) == NULL){
+		return NULL;
+	}
+	return carve_top_aligned(asize, aligned_prefix(cur_arena->top_chunk, alignment));
 }
 
 /*
  * free: free the block and add to the list
+ * free_listed is the full path; free_block tries the tcache first.
  */
-void free(void* ptr)
+/*
+ * Heap trimming (see mm.h). With a threshold configured, large free
+ * regions stop pinning RSS at the allocation high-water mark: the free
+ * block resting against the break is shrunk with a negative sbrk, and
+ * the interior pages of other large free blocks are decommitted while
+ * the blocks stay listed for reuse. Off by default (threshold 0).
+ */
+
+// trim threshold in bytes; 0 disables, (size_t)-1 means the
+// MM_TRIM_THRESHOLD environment variable has not been consulted yet
+static size_t trim_threshold = (size_t)-1;
+
+static size_t trim_limit(void){
+	if(trim_threshold == (size_t)-1){
+		const char *env = getenv("MM_TRIM_THRESHOLD");
+		trim_threshold = (env != NULL) ? (size_t)atol(env) : 0;
+	}
+	return trim_threshold;
+}
+
+// return the interior pages of a large listed free block to the OS.
+// The header, the link words (through the cached tree size at offset
+// 40) and the footer stay resident, so the block remains fully usable
+// from the lists and tree; everything between is payload a free block
+// never reads, and decommitted pages read back as zero, which the
+// virgin-memory mark already treats conservatively
+static void trim_decommit(blk_ptr bp, size_t size){
+	char *lo = (char *)bp + 6*HEADER_SIZE;
+	char *hi = (char *)bp + size - 2*HEADER_SIZE;
+	if(hi > lo){
+		mem_decommit(lo, (size_t)(hi - lo));
+	}
+}
+
+// shrink policy for the region at the break: once the free block
+// resting against the epilogue has grown past the threshold, hand the
+// excess back with a negative sbrk. The block keeps threshold bytes
+// as hysteresis, so churn around the limit does not alternate between
+// trimming and re-extending, and sub-page releases are not attempted.
+// In arena mode the region below the break may belong to any arena,
+// so the break is never moved there.
+static void trim_top(void){
+#ifndef MM_ARENAS
+	size_t limit = trim_limit();
+	if(limit == 0){
+		return;
+	}
+
+	blk_ptr epi = mem_heap_hi() + 1 - HEADER_SIZE;
+	if(get_prev_alloc(epi)){
+		return;
+	}
+	size_t size = get_size(epi - FOOTER_SIZE);
+	size_t keep = align(max(limit, MIN_BLOCK_SIZE));
+	if(size <= keep){
+		return;
+	}
+	size_t release = size - keep;
+	if(release < mem_pagesize()){
+		return;
+	}
+
+	blk_ptr bp = epi + HEADER_SIZE - size;
+	bool was_top = (bp == cur_arena->top_chunk);
+	size_t prev_alloc = get_prev_alloc(p_to_header(bp));
+
+	// delete_list_blcok also understands the retained top chunk
+	delete_list_blcok(bp);
+	if(mem_sbrk(-(intptr_t)release) == (void *)-1){
+		// shrinking refused: relist the block unchanged
+		if(was_top){
+			cur_arena->top_chunk = bp;
+		}
+		else{
+			add_list_block(bp, size);
+		}
+		return;
+	}
+
+	// rewrite the shrunk block and the new epilogue, whose prev-alloc
+	// bit stays clear because the block below it is free
+	put(p_to_header(bp), pack_prev(keep, 0, prev_alloc));
+	put(p_to_footer(bp), pack(keep, 0));
+	put(p_to_header(next_bp(bp)), pack(0, 1));
+	if(was_top){
+		cur_arena->top_chunk = bp;
+	}
+	else{
+		add_list_block(bp, keep);
+	}
+#endif /* MM_ARENAS */
+}
+
+static void free_listed(void* ptr)
 {
-	size_t size;
-   	if(ptr == NULL)
-			return;
+	size_t size = get_size(p_to_header(ptr));
 
-	size = get(p_to_header(ptr));
-	// set header and footer of the block to unallocated
-	put(p_to_header(ptr),pack(size, 0));
+	// set header and footer of the block to unallocated,
+	// keeping the previous-allocated bit of the header
+	put(p_to_header(ptr),pack_prev(size, 0, get_prev_alloc(p_to_header(ptr))));
 	put(p_to_footer(ptr),pack(size, 0));
 
+	// tell the next block its predecessor is now free
+	clear_prev_alloc(p_to_header(next_bp(ptr)));
+
 	// add to the list
 	add_list_block(ptr, size);
+
+#ifdef MM_DEFER_COALESCE
+	// just count the free; merging happens in the next batched sweep
+	if(++cur_arena->deferred_free_count >= MM_DEFER_THRESHOLD){
+		coalesce_sweep();
+	}
+#else
 	coalesce(ptr);
+#endif
+
+	// give excess at the break back once the threshold is exceeded
+	// (no-op unless trimming is enabled)
+	trim_top();
+}
+
+static void free_block(void* ptr)
+{
+#if defined(MM_STATS) || TCACHE_SLOTS > 0
+	size_t size = get_size(p_to_header(ptr));
+#endif
+
+#ifdef MM_STATS
+	stat_bins[search_seg_list(size)].frees++;
+#endif
+
+#if TCACHE_SLOTS > 0
+	// tcache fast path: park the block still marked allocated, skipping
+	// the footer write, list insertion and coalescing
+	if(size <= SMALL_BIN_MAX){
+		int ti = small_bin_index(size);
+		if(cur_arena->tcache_count[ti] < TCACHE_SLOTS){
+			putptr(ptr, cur_arena->tcache[ti]);
+			cur_arena->tcache[ti] = ptr;
+			cur_arena->tcache_count[ti]++;
+			cur_arena->tcache_total++;
+			return;
+		}
+	}
+#endif
+
+	free_listed(ptr);
 }
 
+#if TCACHE_SLOTS > 0
+// function that returns every cached block to the free lists, run when
+// an allocation would otherwise have to grow the heap
+static void tcache_flush(void){
+	for(int i = 0; i < SMALL_BIN_COUNT; i++){
+		while(cur_arena->tcache[i] != NULL){
+			blk_ptr bp = cur_arena->tcache[i];
+			cur_arena->tcache[i] = (blk_ptr)(*(size_t **)bp);
+			cur_arena->tcache_count[i]--;
+			free_listed(bp);
+		}
+	}
+	cur_arena->tcache_total = 0;
+}
+#endif /* TCACHE_SLOTS > 0 */
+
 /*
  * realloc: return a new pointer that has the size and content of the old pointer
- * malloc space for the new pointer
+ * resize in place when possible: shrinks split the tail off the current
+ * block, and grows absorb the next physical block when it is free and
+ * large enough. Only when neither applies is a new block allocated and
+ * the payload copied.
  */
-void* realloc(void* oldptr, size_t size)
+static void* realloc_block(void* oldptr, size_t size)
 {
 	// new pointer
 	blk_ptr newptr;
 
+	// compute the adjusted block size the same way malloc does
+	size_t asize;
+	if(size <= MIN_BLOCK_SIZE - HEADER_SIZE){
+		asize = MIN_BLOCK_SIZE;
+	}
+	else{
+		asize = align(size + HEADER_SIZE);
+	}
+
+	size_t csize = get_size(p_to_header(oldptr));
+	size_t prev_alloc = get_prev_alloc(p_to_header(oldptr));
+
+	// shrink in place: split the tail off as a free block if it is
+	// large enough to stand on its own, otherwise keep the slack
+	if(asize <= csize){
+		if((csize - asize) >= MIN_BLOCK_SIZE){
+			put(p_to_header(oldptr), pack_prev(asize, 1, prev_alloc) | arena_tag());
+			blk_ptr tail = next_bp(oldptr);
+			put(p_to_header(tail), pack_prev(csize-asize, 0, 1));
+			put(p_to_footer(tail), pack(csize-asize, 0));
+			clear_prev_alloc(p_to_header(next_bp(tail)));
+			add_list_block(tail, csize-asize);
+			coalesce(tail);
+		}
+		return oldptr;
+	}
+
+	// grow in place: absorb the next physical block if it is free and
+	// makes the combined block large enough
+	blk_ptr next = next_bp(oldptr);
+	if(!get_alloc(p_to_header(next)) && (csize + get_size(p_to_header(next))) >= asize){
+		size_t combined = csize + get_size(p_to_header(next));
+		delete_list_blcok(next);
+		if((combined - asize) >= MIN_BLOCK_SIZE){
+			// split the surplus back onto the free list
+			put(p_to_header(oldptr), pack_prev(asize, 1, prev_alloc) | arena_tag());
+			blk_ptr tail = next_bp(oldptr);
+			put(p_to_header(tail), pack_prev(combined-asize, 0, 1));
+			put(p_to_footer(tail), pack(combined-asize, 0));
+			add_list_block(tail, combined-asize);
+		}
+		else{
+			put(p_to_header(oldptr), pack_prev(combined, 1, prev_alloc) | arena_tag());
+			set_prev_alloc(p_to_header(next_bp(oldptr)));
+		}
+		return oldptr;
+	}
+
+	// fall back: malloc space and copy the content of oldptr
+	newptr = malloc_block(size);
+	if(newptr == NULL){
+		return NULL;
+	}
+	size_t copysize = min(size, csize - HEADER_SIZE);
+	memmove(newptr,oldptr,copysize);
+	free_block(oldptr);
+	return newptr;
+
+}
+
+#ifdef MM_ARENAS
+// function that frees every block other threads have returned to this
+// arena; the caller holds the arena lock and cur_arena is set
+static void drain_remote_frees(void){
+	blk_ptr head = __atomic_exchange_n(&cur_arena->remote_frees, NULL, __ATOMIC_ACQUIRE);
+	while(head != NULL){
+		blk_ptr next = (blk_ptr)(*(size_t **)head);
+		free_block(head);
+		head = next;
+	}
+}
+#endif /* MM_ARENAS */
+
+/*
+ * Incremental sampled heap validation (see mm.h). Unlike mm_checkheap
+ * this is always compiled: every check_rate-th operation validates a
+ * small window of blocks walked forward from the block that operation
+ * touched. Anchoring at the operation's own block bounds the cost and
+ * avoids keeping a cursor that would go stale when blocks merge or
+ * split between samples.
+ */
+#define CHECK_WINDOW 8
+
+// sampling rate: 0 is off; (size_t)-1 means the MM_CHECK_RATE
+// environment variable has not been consulted yet. Like the MM_STATS
+// counters these are plain unsynchronized variables in arena mode.
+static size_t check_rate = (size_t)-1;
+static size_t check_countdown = 0;
+static size_t check_error_count = 0;
+
+static void check_fail(const char *what, blk_ptr bp){
+	fprintf(stderr, "mm_check: %s at block %p\n", what, (void *)bp);
+	check_error_count++;
+}
+
+// function that validates up to CHECK_WINDOW blocks starting at bp,
+// stopping early at the epilogue of bp's segment
+static void check_window(blk_ptr bp){
+	char *lo = mem_heap_lo();
+	char *hi = lo + mem_heapsize();
+
+	for(int i = 0; i < CHECK_WINDOW; i++){
+		size_t *hp = p_to_header(bp);
+		size_t size = get_size(hp);
+
+		// the epilogue ends this segment's run of blocks
+		if(size == 0){
+			return;
+		}
+		// compare against the remaining heap so a smashed size cannot
+		// overflow the pointer arithmetic past the bound
+		if(size % ALIGNMENT != 0 || size < MIN_BLOCK_SIZE ||
+				(char *)bp < lo || size > (size_t)(hi - (char *)hp)){
+			check_fail("bogus block size", bp);
+			// the walk cannot be trusted past a corrupt header
+			return;
+		}
+
+		if(!get_alloc(hp)){
+			// only free blocks carry a footer
+			if(get_size(p_to_footer(bp)) != size){
+				check_fail("header and footer size mismatch", bp);
+			}
+#ifndef MM_DEFER_COALESCE
+			// adjacent free blocks are only legal while coalescing
+			// is deferred
+			if(!get_alloc(p_to_header(next_bp(bp)))){
+				check_fail("adjacent free blocks", bp);
+			}
+#endif
+			// list membership via the back-pointers; the top chunk is
+			// legitimately unlisted and tree blocks link differently
+			if(bp != cur_arena->top_chunk && size < LARGE_TREE_MIN){
+				blk_ptr lprev = prev_listbp(bp);
+				blk_ptr lnext = next_listbp(bp);
+				if(lnext != NULL && prev_listbp(lnext) != bp){
+					check_fail("broken forward list link", bp);
+				}
+				if(lprev != NULL){
+					if(next_listbp(lprev) != bp){
+						check_fail("broken backward list link", bp);
+					}
+				}
+				else if(*list_head_for(size) != bp){
+					check_fail("free block not on its list", bp);
+				}
+				// seg lists are size-ordered; small bins are exact
+				if(size > SMALL_BIN_MAX && lnext != NULL &&
+						get_size(p_to_header(lnext)) < size){
+					check_fail("seg list out of order", bp);
+				}
+				// the size cached behind the links must match the header
+				if(size > SMALL_BIN_MAX && get(list_size_slot(bp)) != size){
+					check_fail("stale cached node size", bp);
+				}
+			}
+			// tree nodes cache their size behind the parent link
+			if(bp != cur_arena->top_chunk && size >= LARGE_TREE_MIN &&
+					get(tree_size_slot(bp)) != size){
+				check_fail("stale cached tree size", bp);
+			}
+		}
+
+		// the next block's prev-alloc bit must mirror our alloc bit
+		if(get_alloc(hp) != get_prev_alloc(p_to_header(next_bp(bp)))){
+			check_fail("prev-alloc bit mismatch", bp);
+		}
+
+		bp = next_bp(bp);
+	}
+}
+
+// sampling hook run by the public entry points with a block the
+// operation touched as the anchor
+static void check_op(blk_ptr bp){
+	if(check_rate == (size_t)-1){
+		const char *env = getenv("MM_CHECK_RATE");
+		check_rate = (env != NULL) ? (size_t)atol(env) : 0;
+	}
+	if(check_rate == 0 || bp == NULL){
+		return;
+	}
+	if(++check_countdown < check_rate){
+		return;
+	}
+	check_countdown = 0;
+	check_window(bp);
+}
+
+void mm_check_set_rate(size_t every_n_ops){
+	check_rate = every_n_ops;
+	check_countdown = 0;
+}
+
+size_t mm_check_errors(void){
+	return check_error_count;
+}
+
+void mm_trim_set_threshold(size_t bytes){
+	trim_threshold = bytes;
+}
+
+/*
+ * The public entry points. In arena mode they pin the thread to its
+ * arena, take that arena's lock and route cross-arena frees through the
+ * owner's deferred stack; otherwise they call the internals directly.
+ */
+void* malloc(size_t size)
+{
+#ifdef MM_ARENAS
+	struct arena *a = arena_for_thread();
+	pthread_mutex_lock(&a->lock);
+	cur_arena = a;
+	drain_remote_frees();
+	void *bp = malloc_block(size);
+	check_op(bp);
+	pthread_mutex_unlock(&a->lock);
+	return bp;
+#else
+	void *bp = malloc_block(size);
+	if(bp != NULL){
+		// the application may now write anywhere in the payload
+		touch_raise((char *)bp + get_size(p_to_header(bp)) - HEADER_SIZE);
+	}
+	check_op(bp);
+	return bp;
+#endif
+}
+
+void free(void* ptr)
+{
+	if(ptr == NULL){
+		return;
+	}
+#ifdef MM_ARENAS
+	struct arena *owner = get_owner(p_to_header(ptr));
+	if(owner != arena_for_thread()){
+		// hand the block back to its owner through a lock-free push;
+		// the owner drains the stack on its next allocation
+		blk_ptr old;
+		do{
+			old = __atomic_load_n(&owner->remote_frees, __ATOMIC_RELAXED);
+			putptr(ptr, old);
+		}while(!__atomic_compare_exchange_n(&owner->remote_frees, &old, ptr,
+				false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+		return;
+	}
+	pthread_mutex_lock(&owner->lock);
+	cur_arena = owner;
+	// sample before the free while ptr is still a valid anchor
+	check_op(ptr);
+	free_block(ptr);
+	pthread_mutex_unlock(&owner->lock);
+#else
+	// sample before the free while ptr is still a valid anchor
+	check_op(ptr);
+	free_block(ptr);
+#endif
+}
+
+void* realloc(void* oldptr, size_t size)
+{
 	// call equivalent to malloc(size)
 	if(oldptr == NULL){
 		return malloc(size);
 	}
-	
+
 	// call equivalent free(oldptr) if size is 0
 	if(size == 0){
 		free(oldptr);
 		return NULL;
 	}
 
-	// malloc space and copy the content of oldptr
-	newptr = malloc(size);
-	size_t copysize = min(size, get_size(p_to_header(oldptr)) - HEADER_SIZE);
-	memmove(newptr,oldptr,copysize);
-	free(oldptr);
+#ifdef MM_ARENAS
+	struct arena *owner = get_owner(p_to_header(oldptr));
+	if(owner != arena_for_thread()){
+		// cross-arena resize: allocate locally, then hand the old
+		// block back through the remote-free path
+		void *newptr = malloc(size);
+		if(newptr == NULL){
+			return NULL;
+		}
+		size_t copysize = min(size, get_size(p_to_header(oldptr)) - HEADER_SIZE);
+		memmove(newptr, oldptr, copysize);
+		free(oldptr);
+		return newptr;
+	}
+	pthread_mutex_lock(&owner->lock);
+	cur_arena = owner;
+	void *newptr = realloc_block(oldptr, size);
+	check_op(newptr);
+	pthread_mutex_unlock(&owner->lock);
 	return newptr;
-
+#else
+	void *newptr = realloc_block(oldptr, size);
+	if(newptr != NULL){
+		touch_raise((char *)newptr + get_size(p_to_header(newptr)) - HEADER_SIZE);
+	}
+	check_op(newptr);
+	return newptr;
+#endif
 }
 
 /*
  * calloc
- * This function is not tested by mdriver, and has been implemented for you.
+ * A block carved entirely from heap above the touched mark has never
+ * been written — not by the application, not by free-list links or
+ * footers — so it is still the zero bytes of the fresh mapping and the
+ * memset can be skipped. Recycled blocks, including tcache hits, sit
+ * below the mark and get zeroed as before. The two words just under
+ * the break are excluded because the top chunk footer and the epilogue
+ * live there; a block reaching into them is zeroed too.
  */
 void* calloc(size_t nmemb, size_t size)
 {
-    void* ret;
-    size *= nmemb;
-    ret = malloc(size);
-    if (ret) {
-        memset(ret, 0, size);
-    }
-    return ret;
+	void* ret;
+	size *= nmemb;
+#ifdef MM_ARENAS
+	ret = malloc(size);
+	if(ret != NULL){
+		memset(ret, 0, size);
+	}
+	return ret;
+#else
+	// call the internal path so the block can be tested against the
+	// mark before it is raised over this block's own payload
+	ret = malloc_block(size);
+	if(ret == NULL){
+		return NULL;
+	}
+	char *top = (char *)mem_heap_lo() + mem_heapsize();
+	bool virgin = (char *)ret >= touched_hi &&
+			(char *)ret + size <= top - 2*HEADER_SIZE;
+	touch_raise((char *)ret + get_size(p_to_header(ret)) - HEADER_SIZE);
+	check_op(ret);
+	if(!virgin){
+		memset(ret, 0, size);
+	}
+	return ret;
+#endif
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+#ifdef MM_ARENAS
+	struct arena *a = arena_for_thread();
+	pthread_mutex_lock(&a->lock);
+	cur_arena = a;
+	drain_remote_frees();
+	void *bp = aligned_alloc_block(alignment, size);
+	check_op(bp);
+	pthread_mutex_unlock(&a->lock);
+	return bp;
+#else
+	void *bp = aligned_alloc_block(alignment, size);
+	if(bp != NULL){
+		touch_raise((char *)bp + get_size(p_to_header(bp)) - HEADER_SIZE);
+	}
+	check_op(bp);
+	return bp;
+#endif
+}
+
+// classic spelling of the same call; DMA code tends to use this name
+void* memalign(size_t alignment, size_t size)
+{
+	return aligned_alloc(alignment, size);
 }
 
 /*
@@ -503,31 +1852,119 @@ static bool aligned(const void* p)
 
 bool mm_checkheap(int lineno)
 {
-	#ifdef DEBUG
+	#if defined(DEBUG) && !defined(MM_ARENAS)
+	/* the walk below assumes one contiguous run of blocks, which does
+	 * not hold for the fenced per-arena segments of arena mode */
 	printf("Enter checkheap\n");
     size_t size = 0;
     heap_list_ptr = mem_heap_lo() + 2*HEADER_SIZE;
     while (get_size(p_to_header(heap_list_ptr)) != 0){
-		// check for size
+		// check for size, only free blocks carry a footer
         size = get_size(p_to_header(heap_list_ptr));
-        if (size != get_size(p_to_footer(heap_list_ptr))){
-            printf("Header and footer size mismatch\n");
-        }
-
-        //check for adjacent free block 
         if (!get_alloc(p_to_header(heap_list_ptr))){
+            if (size != get_size(p_to_footer(heap_list_ptr))){
+                printf("Header and footer size mismatch\n");
+            }
+
+            //check for adjacent free block
             if (!get_alloc(p_to_header(next_bp(heap_list_ptr)))){
                 printf("Found adjacent block\n");
             }
         }
 
+        //check that the next block's prev-alloc bit matches our alloc bit
+        if (get_alloc(p_to_header(heap_list_ptr)) !=
+                get_prev_alloc(p_to_header(next_bp(heap_list_ptr)))){
+            printf("Prev-alloc bit mismatch\n");
+        }
+
         heap_list_ptr = heap_list_ptr + size;
     }
 
-	#endif /* DEBUG */
+	#endif /* DEBUG && !MM_ARENAS */
     return true;
 }
 
+/*
+ * Statistics surface declared in mm.h. Without -DMM_STATS the getters
+ * report zero bins and the hot-path counters do not exist at all.
+ */
+size_t mm_stats_bin_count(void)
+{
+#ifdef MM_STATS
+	return SEG_LIST_SIZE;
+#else
+	return 0;
+#endif
+}
+
+bool mm_stats_get_bin(size_t bin, mm_bin_stats_t *stats)
+{
+#ifdef MM_STATS
+	if(bin >= SEG_LIST_SIZE){
+		return false;
+	}
+	*stats = stat_bins[bin];
+	return true;
+#else
+	(void)bin;
+	(void)stats;
+	return false;
+#endif
+}
+
+void mm_stats_get_heap(mm_heap_stats_t *stats)
+{
+#ifdef MM_STATS
+	*stats = stat_heap;
+#else
+	mm_heap_stats_t zero = {0, 0};
+	*stats = zero;
+#endif
+}
+
+void mm_stats_reset(void)
+{
+#ifdef MM_STATS
+	mm_bin_stats_t zero_bin = {0, 0, 0, 0, 0, 0, 0};
+	for(int i = 0; i < SEG_LIST_SIZE; i++){
+		stat_bins[i] = zero_bin;
+	}
+	stat_heap.sbrk_calls = 0;
+	stat_heap.sbrk_bytes = 0;
+#endif
+}
+
+/*
+ * Heap introspection surface declared in mm.h, used by the offline
+ * fragmentation analyzer (manalyze). Always compiled; the walk costs
+ * one header read per block and has no effect on allocator state.
+ */
+void mm_heap_walk(mm_walk_fun fn, void *ctx)
+{
+	// the first real block sits just past the 16-byte prologue;
+	// the walk ends at the zero-sized epilogue header. Blocks parked
+	// in the tcache stay marked allocated and are reported as such:
+	// they are not reusable address space until flushed.
+	blk_ptr bp = mem_heap_lo() + 4*HEADER_SIZE;
+	size_t size;
+
+	while((size = get_size(p_to_header(bp))) != 0){
+		fn(bp, size, get_alloc(p_to_header(bp)) != 0, ctx);
+		bp = next_bp(bp);
+	}
+}
+
+size_t mm_size_class_count(void)
+{
+	return SEG_LIST_SIZE;
+}
+
+size_t mm_size_class(size_t size)
+{
+	return (size_t)search_seg_list(size);
+}
+
 
 
 
@@ -8,6 +8,8 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc (size_t nmemb, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
 
 #else
 
@@ -16,10 +18,95 @@ extern void *malloc (size_t size);
 extern void free (void *ptr);
 extern void *realloc(void *ptr, size_t size);
 extern void *calloc (size_t nmemb, size_t size);
+extern void *aligned_alloc(size_t alignment, size_t size);
+extern void *memalign(size_t alignment, size_t size);
 
 #endif
 
 extern bool mm_init(void);
 
+/*
+ * Capture / restore the allocator's internal state (free structures,
+ * top chunk, caches). Pair with mem_snapshot/mem_restore: restoring
+ * both puts a warmed heap back in one copy, so timed repetitions
+ * measure steady-state behavior instead of the extend_heap ramp.
+ * Single-threaded use only.
+ */
+extern void mm_snapshot(void);
+extern void mm_restore(void);
+
 /* This is for debugging.  Returns false if error encountered */
 extern bool mm_checkheap(int lineno);
+
+/*
+ * Allocator statistics, collected when mm.c is compiled with -DMM_STATS.
+ * Counters are plain unsynchronized increments on the hot path; without
+ * the flag they compile out entirely and the getters report zero bins.
+ */
+typedef struct {
+    size_t allocs;        /* allocations served from this size class */
+    size_t frees;         /* frees landing in this size class */
+    size_t splits;        /* blocks of this class split by placement */
+    size_t coalesces;     /* merges producing a block of this class */
+    size_t scans;         /* free-list scans through this class */
+    size_t scan_steps;    /* total list nodes visited by those scans */
+    size_t scan_max;      /* longest single scan */
+} mm_bin_stats_t;
+
+typedef struct {
+    size_t sbrk_calls;    /* number of heap extensions */
+    size_t sbrk_bytes;    /* total bytes requested from mem_sbrk */
+} mm_heap_stats_t;
+
+/* Number of size classes reported; 0 when stats are compiled out */
+extern size_t mm_stats_bin_count(void);
+/* Copy out one class's counters; returns false if bin is out of range */
+extern bool mm_stats_get_bin(size_t bin, mm_bin_stats_t *stats);
+/* Copy out the heap-level counters */
+extern void mm_stats_get_heap(mm_heap_stats_t *stats);
+/* Zero all counters (also done by mm_init) */
+extern void mm_stats_reset(void);
+
+/*
+ * Incremental sampled heap validation, always compiled (unlike
+ * mm_checkheap, which needs -DDEBUG). Every Nth allocator operation
+ * validates a bounded window of blocks around the block the operation
+ * touched: header/footer agreement, free-list membership through the
+ * back-pointers, no adjacent free blocks and matching prev-alloc bits.
+ * Failures are reported on stderr and counted; the walk is bounded, so
+ * overhead scales with 1/N. The MM_CHECK_RATE environment variable
+ * supplies the initial rate; 0 (the default) disables sampling.
+ */
+/* Sample every Nth operation; 0 disables */
+extern void mm_check_set_rate(size_t every_n_ops);
+/* Number of validation failures found so far */
+extern size_t mm_check_errors(void);
+
+/*
+ * Heap introspection for offline analysis tools (see manalyze.c).
+ * mm_heap_walk visits every block between the prologue and the
+ * epilogue in address order, passing the payload pointer, block size
+ * and allocated flag. Single-threaded use only; arena-mode heaps are
+ * split into per-arena segments the walk does not cross, so analyzer
+ * builds are single-arena. The size-class helpers expose the
+ * allocator's own segregated-list classification so external
+ * histograms stay in sync with retuned class boundaries.
+ */
+typedef void (*mm_walk_fun)(void *payload, size_t size, bool allocated,
+                            void *ctx);
+extern void mm_heap_walk(mm_walk_fun fn, void *ctx);
+/* Number of segregated-list size classes */
+extern size_t mm_size_class_count(void);
+/* The allocator's size class index for a given block size */
+extern size_t mm_size_class(size_t size);
+
+/*
+ * Heap trimming. With a threshold set (here or via the
+ * MM_TRIM_THRESHOLD environment variable), free regions larger than
+ * the threshold stop pinning RSS at the allocation high-water mark:
+ * the free block at the break is shrunk with a negative sbrk, and the
+ * interior pages of other large free blocks are returned to the OS
+ * with madvise while the blocks stay on the free lists for reuse.
+ * 0 (the default) disables trimming.
+ */
+extern void mm_trim_set_threshold(size_t bytes);
@@ -1,6 +1,8 @@
 /*
  * Splay tree implementation
- * Based on code in https://en.wikipedia.org/wiki/Splay_tree
+ * Based on code in https://en.wikipedia.org/wiki/Splay_tree,
+ * reworked to use a top-down splay (no parent pointers) and a slab
+ * pool for nodes.
  *
  * Students are welcome to borrow and adapt this code for any
  * assignment in 15-213/18-213/15-513
@@ -10,14 +12,20 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include "stree.h"
-  
+
+/* Nodes are carved from slabs of this many at a time; removed nodes
+   go onto a freelist threaded through their left pointers */
+#define SLAB_NODES 1024
+
+struct slab {
+    struct slab *next;
+    node_t nodes[SLAB_NODES];
+};
+
+static node_t *node_alloc(tree_t *tree);
+static void node_free(tree_t *tree, node_t *z);
+static node_t *splay(tree_t *tree, node_t *t, tkey_t key);
 static void free_subtree(node_t *x, free_fun_t free_fun);
-static void left_rotate(tree_t *tree, node_t *x);
-static void right_rotate(tree_t *tree, node_t *x);
-static void splay(tree_t *tree, node_t *x);
-static void replace(tree_t *tree, node_t *u, node_t *v);
-static node_t *subtree_minimum(node_t *u);
-static node_t *subtree_maximum(node_t *u);
 static void show_subtree(node_t *x, bool tree_mode);
 
 tree_t *tree_new() {
@@ -29,113 +37,104 @@ tree_t *tree_new() {
     tree->root = NULL;
     tree->node_count = 0;
     tree->comparison_count = 0;
+    tree->slabs = NULL;
+    tree->free_nodes = NULL;
+    tree->slab_used = 0;
     return tree;
 }
 
 void tree_free(tree_t *tree, free_fun_t free_fun) {
-    if (tree->root)
+    struct slab *s = tree->slabs;
+    if (free_fun && tree->root)
 	free_subtree(tree->root, free_fun);
+    while (s) {
+	struct slab *next = s->next;
+	free(s);
+	s = next;
+    }
     free(tree);
 }
 
 bool tree_insert(tree_t *tree, tkey_t key, void *record) {
-    node_t *z = tree->root;
-    node_t *p = NULL;
-    
-    while (z) {
-	p = z;
-	tree->comparison_count++;
-	if (key == z->key)
+    node_t *t = tree->root;
+    node_t *z;
+
+    if (t) {
+	t = splay(tree, t, key);
+	if (t->key == key) {
 	    /* Already have key in tree */
+	    tree->root = t;
 	    return false;
-	tree->comparison_count++;
-	if (key > z->key)
-	    z = z->right;
-	else
-	    z = z->left;
-    }
-    
-    z = malloc(sizeof(node_t));
-    if (!z) {
-	fprintf(stderr, "ERROR.  Couldn't create range tree node\n");
-	exit(1);
+	}
     }
+    z = node_alloc(tree);
     z->key = key;
     z->record = record;
-    z->parent = p;
-    z->left = z->right = NULL;
-    if (!p) tree->root = z;
-    else if (p->key < z->key) p->right = z;
-    else p->left = z;
-    splay(tree, z);
+    if (!t) {
+	z->left = z->right = NULL;
+    } else if (key < t->key) {
+	/* t is the successor of key: it and its right subtree go
+	   right of the new root, its left subtree goes left */
+	z->left = t->left;
+	z->right = t;
+	t->left = NULL;
+    } else {
+	z->right = t->right;
+	z->left = t;
+	t->right = NULL;
+    }
+    tree->root = z;
     tree->node_count++;
     return true;
 }
-  
+
 void *tree_find(tree_t *tree, tkey_t key) {
-    node_t *z = tree->root;
-    while (z) {
-	tree->comparison_count++;
-	if (key == z->key)
-	    return z->record;
-	tree->comparison_count++;
-	if (key > z->key)
-	    z = z->right;
-	else
-	    z = z->left;
-    }
+    tree->root = splay(tree, tree->root, key);
+    if (tree->root && tree->root->key == key)
+	return tree->root->record;
     return NULL;
 }
 
 void *tree_find_nearest(tree_t *tree, tkey_t key) {
-    node_t *z = tree->root;
-    node_t *n = NULL;
-    while (z) {
-	tree->comparison_count++;
-	if (key == z->key)
-	    return z->record;
+    node_t *z;
+
+    tree->root = splay(tree, tree->root, key);
+    if (!tree->root)
+	return NULL;
+    if (tree->root->key <= key)
+	return tree->root->record;
+    /* The root is the successor of key, so the nearest smaller key
+       is the maximum of its left subtree */
+    z = tree->root->left;
+    if (!z)
+	return NULL;
+    while (z->right) {
 	tree->comparison_count++;
-	if (key > z->key) {
-	    if (!n || n->key < z->key)
-		n = z;
-	    z = z->right;
-	}
-	else
-	    z = z->left;
+	z = z->right;
     }
-    return n ? n->record : NULL;
+    return z->record;
 }
 
-        
 void *tree_remove(tree_t *tree, tkey_t key) {
-    node_t *z = tree->root;
-    void *r = NULL;
-    while (z && z->key != key) {
-	tree->comparison_count++;
-	if (key > z->key)
-	    z = z->right;
-	else
-	    z = z->left;
-    }
-    if (!z)
-	return r;
-    splay(tree, z);
-    if (!z->left) replace(tree, z, z->right);
-    else if (!z->right) replace(tree, z, z->left);
-    else {
-	node_t *y = subtree_minimum(z->right);
-	if (y->parent != z) {
-	    replace(tree, y, y->right);
-	    y->right = z->right;
-	    y->right->parent = y;
-	}
-	replace(tree, z, y);
-	y->left = z->left;
-	y->left->parent = y;
+    node_t *t = splay(tree, tree->root, key);
+    node_t *x;
+    void *r;
+
+    tree->root = t;
+    if (!t || t->key != key)
+	return NULL;
+    r = t->record;
+    if (!t->left) {
+	x = t->right;
+    } else {
+	/* Splaying the left subtree for key brings its maximum to
+	   its root, which therefore has no right child */
+	x = splay(tree, t->left, key);
+	x->right = t->right;
     }
-    r = z->record;
+    tree->root = x;
     tree->node_count--;
-    free(z);
+    node_free(tree, t);
     return r;
 }
 
@@ -151,80 +150,100 @@ void tree_show(tree_t *tree, bool tree_mode) {
 
 /*** Helper functions ***/
 
-static void free_subtree(node_t *x, free_fun_t free_fun) {
-    if (!x)
-	return;
-    free_subtree(x->left, free_fun);
-    free_subtree(x->right, free_fun);
-    if (free_fun)
-	free_fun(x->record);
-    free(x);
-}
-
-static void left_rotate(tree_t *tree, node_t *x) {
-    node_t *y = x->right;
-    if (y) {
-	x->right = y->left;
-	if (y->left) y->left->parent = x;
-	y->parent = x->parent;
+static node_t *node_alloc(tree_t *tree) {
+    node_t *z = tree->free_nodes;
+    if (z) {
+	tree->free_nodes = z->left;
+	return z;
     }
-    if (!x->parent) tree->root = y;
-    else if (x == x->parent->left) x->parent->left = y;
-    else x->parent->right = y;
-    if (y) y->left = x;
-    x->parent = y;
-}
-  
-static void right_rotate(tree_t *tree, node_t *x) {
-    node_t *y = x->left;
-    if (y) {
-	x->left = y->right;
-	if (y->right) y->right->parent = x;
-	y->parent = x->parent;
+    if (!tree->slabs || tree->slab_used == SLAB_NODES) {
+	struct slab *s = malloc(sizeof(struct slab));
+	if (!s) {
+	    fprintf(stderr, "ERROR.  Couldn't create range tree node\n");
+	    exit(1);
+	}
+	s->next = tree->slabs;
+	tree->slabs = s;
+	tree->slab_used = 0;
     }
-    if (!x->parent) tree->root = y;
-    else if (x == x->parent->left) x->parent->left = y;
-    else x->parent->right = y;
-    if (y) y->right = x;
-    x->parent = y;
+    return &tree->slabs->nodes[tree->slab_used++];
 }
-  
-static void splay(tree_t *tree, node_t *x) {
-    while (x->parent) {
-	if (!x->parent->parent) {
-	    if (x->parent->left == x) right_rotate(tree, x->parent);
-	    else left_rotate(tree, x->parent);
-	} else if (x->parent->left == x && x->parent->parent->left == x->parent) {
-	    right_rotate(tree, x->parent->parent);
-	    right_rotate(tree, x->parent);
-	} else if (x->parent->right == x && x->parent->parent->right == x->parent) {
-	    left_rotate(tree, x->parent->parent);
-	    left_rotate(tree, x->parent);
-	} else if (x->parent->left == x && x->parent->parent->right == x->parent) {
-	    right_rotate(tree, x->parent);
-	    left_rotate(tree, x->parent);
+
+static void node_free(tree_t *tree, node_t *z) {
+    z->left = tree->free_nodes;
+    tree->free_nodes = z;
+}
+
+/*
+ * Top-down splay: make the node with the given key — or the last node
+ * on its search path — the root of the subtree t and return it. The
+ * path is split on the way down into a tree of smaller keys and a
+ * tree of larger keys, reassembled around the final root, so no
+ * parent pointers are ever needed.
+ */
+static node_t *splay(tree_t *tree, node_t *t, tkey_t key) {
+    node_t N;
+    node_t *l, *r, *y;
+
+    if (!t)
+	return NULL;
+    N.left = N.right = NULL;
+    l = r = &N;
+    for (;;) {
+	tree->comparison_count++;
+	if (key < t->key) {
+	    if (!t->left)
+		break;
+	    tree->comparison_count++;
+	    if (key < t->left->key) {
+		/* zig-zig: rotate right */
+		y = t->left;
+		t->left = y->right;
+		y->right = t;
+		t = y;
+		if (!t->left)
+		    break;
+	    }
+	    /* link right: t goes into the tree of larger keys */
+	    r->left = t;
+	    r = t;
+	    t = t->left;
+	} else if (key > t->key) {
+	    if (!t->right)
+		break;
+	    tree->comparison_count++;
+	    if (key > t->right->key) {
+		/* zig-zig: rotate left */
+		y = t->right;
+		t->right = y->left;
+		y->left = t;
+		t = y;
+		if (!t->right)
+		    break;
+	    }
+	    /* link left: t goes into the tree of smaller keys */
+	    l->right = t;
+	    l = t;
+	    t = t->right;
 	} else {
-	    left_rotate(tree, x->parent);
-	    right_rotate(tree, x->parent);
+	    break;
 	}
     }
+    /* reassemble: hang t's subtrees off the split trees, then the
+       split trees off t */
+    l->right = t->left;
+    r->left = t->right;
+    t->left = N.right;
+    t->right = N.left;
+    return t;
 }
-  
-static void replace(tree_t *tree, node_t *u, node_t *v) {
-    if (!u->parent) tree->root = v;
-    else if (u == u->parent->left) u->parent->left = v;
-    else u->parent->right = v;
-    if (v) v->parent = u->parent;
-}
-  
-static node_t* subtree_minimum(node_t *u) {
-    while (u->left) u = u->left;
-    return u;
-}
-  
-static node_t* subtree_maximum(node_t *u) {
-    while (u->right) u = u->right;
-    return u;
+
+static void free_subtree(node_t *x, free_fun_t free_fun) {
+    if (!x)
+	return;
+    free_subtree(x->left, free_fun);
+    free_subtree(x->right, free_fun);
+    free_fun(x->record);
 }
 
 static void show_subtree(node_t *x, bool tree_mode) {
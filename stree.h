@@ -10,17 +10,26 @@ typedef long tkey_t;
 
 typedef void (*free_fun_t)(void *r);
 
+/* Nodes carry no parent pointer: the splay is top-down, so rotations
+   only ever touch the path being descended */
 typedef struct node {
     struct node *left, *right;
-    struct node *parent;
     tkey_t key;
     void *record;  // Points to user data */
 } node_t;
-    
+
+struct slab;
+
 typedef struct {
     node_t *root;
     size_t node_count;
     size_t comparison_count;
+    /* node pool: nodes come from bulk-allocated slabs and removed
+       nodes are recycled through a freelist, so tree churn costs no
+       malloc/free traffic */
+    struct slab *slabs;
+    node_t *free_nodes;
+    size_t slab_used;
 } tree_t;
 
 tree_t *tree_new();
@@ -0,0 +1,134 @@
+/*
+ * traceconv.c - convert .rep text traces to the binary format that
+ * mdriver can mmap directly (see bintrace.h).
+ *
+ * Usage: traceconv tracefile.rep ...
+ *
+ * Each input file is parsed once and written back out alongside the
+ * original with "b" appended to the name (foo.rep -> foo.repb).
+ * mdriver picks the binary file up automatically when it exists.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bintrace.h"
+
+static int convert(const char *filename)
+{
+    FILE *in, *out;
+    char outname[1024];
+    char type[64];
+    bintrace_header_t header;
+    bintraceop_t *ops;
+    int iweight;
+    unsigned index;
+    unsigned long size;
+    int op_index;
+    int ignore = 0;
+
+    if ((in = fopen(filename, "r")) == NULL) {
+	fprintf(stderr, "traceconv: could not open %s\n", filename);
+	return 1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINTRACE_MAGIC, BINTRACE_MAGIC_LEN);
+    ignore += fscanf(in, "%d", &iweight);
+    header.weight = iweight;
+    ignore += fscanf(in, "%d", &header.num_ids);
+    ignore += fscanf(in, "%d", &header.num_ops);
+    ignore += fscanf(in, "%lu", (unsigned long *) &header.data_bytes);
+
+    if (header.num_ops <= 0) {
+	fprintf(stderr, "traceconv: bogus op count in %s\n", filename);
+	fclose(in);
+	return 1;
+    }
+
+    if ((ops = malloc(header.num_ops * sizeof(bintraceop_t))) == NULL) {
+	fprintf(stderr, "traceconv: out of memory\n");
+	fclose(in);
+	return 1;
+    }
+
+    op_index = 0;
+    while (fscanf(in, "%63s", type) != EOF) {
+	bintraceop_t *op = &ops[op_index];
+	op->unused = 0;
+	op->size = 0;
+	switch (type[0]) {
+	case 'a':
+	    ignore += fscanf(in, "%u %lu", &index, &size);
+	    op->type = 0;
+	    op->index = index;
+	    op->size = size;
+	    break;
+	case 'r':
+	    ignore += fscanf(in, "%u %lu", &index, &size);
+	    op->type = 2;
+	    op->index = index;
+	    op->size = size;
+	    break;
+	case 'f':
+	    ignore += fscanf(in, "%u", &index);
+	    op->type = 1;
+	    op->index = index;
+	    break;
+	default:
+	    fprintf(stderr, "traceconv: bogus type character (%c) in %s\n",
+		    type[0], filename);
+	    free(ops);
+	    fclose(in);
+	    return 1;
+	}
+	op_index++;
+	if (op_index == header.num_ops) break;
+    }
+    fclose(in);
+
+    if (op_index != header.num_ops) {
+	fprintf(stderr, "traceconv: %s: expected %d ops, found %d\n",
+		filename, header.num_ops, op_index);
+	free(ops);
+	return 1;
+    }
+
+    if (snprintf(outname, sizeof(outname), "%sb", filename)
+	>= (int) sizeof(outname)) {
+	fprintf(stderr, "traceconv: output name too long for %s\n", filename);
+	free(ops);
+	return 1;
+    }
+    if ((out = fopen(outname, "wb")) == NULL) {
+	fprintf(stderr, "traceconv: could not create %s\n", outname);
+	free(ops);
+	return 1;
+    }
+    if (fwrite(&header, sizeof(header), 1, out) != 1 ||
+	fwrite(ops, sizeof(bintraceop_t), header.num_ops, out)
+	!= (size_t) header.num_ops) {
+	fprintf(stderr, "traceconv: write failed for %s\n", outname);
+	fclose(out);
+	free(ops);
+	return 1;
+    }
+    fclose(out);
+    free(ops);
+    printf("%s -> %s (%d ops)\n", filename, outname, header.num_ops);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int i;
+    int status = 0;
+
+    if (argc < 2) {
+	fprintf(stderr, "Usage: %s tracefile.rep ...\n", argv[0]);
+	return 1;
+    }
+    for (i = 1; i < argc; i++)
+	status |= convert(argv[i]);
+    return status;
+}
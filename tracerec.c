@@ -0,0 +1,315 @@
+/*
+ * tracerec.c - LD_PRELOAD shim that records an application's
+ * malloc/free/realloc/calloc stream as a raw allocation log.
+ *
+ * Usage:
+ *     gcc -O2 -shared -fPIC -o tracerec.so tracerec.c -lpthread -ldl
+ *     TRACEREC_OUT=app.raw LD_PRELOAD=./tracerec.so ./app ...
+ *     ./tracerec2rep app.raw app.rep
+ *
+ * Design notes:
+ *  - Each thread appends records to its own mmap'd buffer, so the hot
+ *    path is a few stores plus a counter bump; no locks are taken
+ *    until a buffer fills.
+ *  - Full buffers are handed to a background flusher thread that
+ *    writes them to the output file, so recording threads never block
+ *    on disk.  Record order across threads is therefore approximate,
+ *    which is fine for a single-threaded replay format.
+ *  - The shim itself never calls malloc: buffers come from mmap, and
+ *    allocations made while the real symbols are still being resolved
+ *    (dlsym calls calloc) are served from a small static arena.
+ *  - Buffers of threads still live at process exit are flushed by the
+ *    destructor only for the exiting thread; other threads' partial
+ *    buffers are lost.  Traces are statistical input for tuning, so a
+ *    truncated tail is acceptable.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "tracerec.h"
+
+#define BUF_RECS 4096          /* records per per-thread buffer */
+#define BOOT_HEAP_BYTES (1 << 20)
+
+/* Real allocator entry points, resolved lazily */
+static void *(*real_malloc)(size_t);
+static void (*real_free)(void *);
+static void *(*real_realloc)(void *, size_t);
+static void *(*real_calloc)(size_t, size_t);
+
+/* Bootstrap arena serving allocations made during symbol resolution */
+static char boot_heap[BOOT_HEAP_BYTES];
+static size_t boot_used;
+static pthread_mutex_t boot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int rec_state;          /* 0 uninitialized, 1 recording, -1 disabled */
+static int out_fd = -1;
+static pthread_key_t buf_key;
+
+/* A flush buffer: a page-aligned mmap region, records after the header */
+typedef struct flushbuf {
+    struct flushbuf *next;
+    size_t count;
+    rawtrace_rec_t recs[BUF_RECS];
+} flushbuf_t;
+
+static __thread flushbuf_t *tbuf;
+static __thread int in_hook;   /* recursion guard */
+
+/* Queue of full buffers awaiting the flusher thread */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static flushbuf_t *queue_head;
+static flushbuf_t *queue_tail;
+static int flusher_exit;
+static pthread_t flusher_tid;
+
+static void *boot_alloc(size_t size)
+{
+    void *p = NULL;
+    pthread_mutex_lock(&boot_lock);
+    size = (size + 15) & ~(size_t) 15;
+    if (boot_used + size <= BOOT_HEAP_BYTES) {
+	p = boot_heap + boot_used;
+	boot_used += size;
+    }
+    pthread_mutex_unlock(&boot_lock);
+    return p;
+}
+
+static int is_boot_ptr(const void *p)
+{
+    return (const char *) p >= boot_heap &&
+	   (const char *) p < boot_heap + BOOT_HEAP_BYTES;
+}
+
+static flushbuf_t *buf_new(void)
+{
+    flushbuf_t *b = mmap(NULL, sizeof(flushbuf_t), PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b == MAP_FAILED)
+	return NULL;
+    b->next = NULL;
+    b->count = 0;
+    return b;
+}
+
+static void buf_enqueue(flushbuf_t *b)
+{
+    pthread_mutex_lock(&queue_lock);
+    if (queue_tail)
+	queue_tail->next = b;
+    else
+	queue_head = b;
+    queue_tail = b;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static void buf_write_out(flushbuf_t *b)
+{
+    size_t len = b->count * sizeof(rawtrace_rec_t);
+    const char *p = (const char *) b->recs;
+    while (len > 0) {
+	ssize_t n = write(out_fd, p, len);
+	if (n <= 0)
+	    break;
+	p += n;
+	len -= n;
+    }
+}
+
+static void *flusher_main(void *arg)
+{
+    (void) arg;
+    for (;;) {
+	flushbuf_t *b;
+	pthread_mutex_lock(&queue_lock);
+	while (queue_head == NULL && !flusher_exit)
+	    pthread_cond_wait(&queue_cond, &queue_lock);
+	b = queue_head;
+	if (b) {
+	    queue_head = b->next;
+	    if (queue_head == NULL)
+		queue_tail = NULL;
+	} else if (flusher_exit) {
+	    pthread_mutex_unlock(&queue_lock);
+	    return NULL;
+	}
+	pthread_mutex_unlock(&queue_lock);
+	if (b) {
+	    buf_write_out(b);
+	    munmap(b, sizeof(flushbuf_t));
+	}
+    }
+}
+
+/* Thread exit: hand the partial buffer to the flusher */
+static void buf_key_destroy(void *p)
+{
+    flushbuf_t *b = p;
+    if (b && b->count > 0)
+	buf_enqueue(b);
+    else if (b)
+	munmap(b, sizeof(flushbuf_t));
+}
+
+static void rec_init(void)
+{
+    const char *path;
+
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+
+    path = getenv("TRACEREC_OUT");
+    if (path == NULL)
+	path = "tracerec.raw";
+    out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out_fd < 0) {
+	rec_state = -1;
+	return;
+    }
+    if (write(out_fd, RAWTRACE_MAGIC, RAWTRACE_MAGIC_LEN)
+	!= RAWTRACE_MAGIC_LEN) {
+	close(out_fd);
+	out_fd = -1;
+	rec_state = -1;
+	return;
+    }
+    pthread_key_create(&buf_key, buf_key_destroy);
+    if (pthread_create(&flusher_tid, NULL, flusher_main, NULL) != 0) {
+	close(out_fd);
+	out_fd = -1;
+	rec_state = -1;
+	return;
+    }
+    rec_state = 1;
+}
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static __thread int init_busy;   /* breaks dlsym -> calloc recursion */
+
+static void ensure_init(void)
+{
+    if (init_busy)
+	return;
+    init_busy = 1;
+    pthread_once(&init_once, rec_init);
+    init_busy = 0;
+}
+
+/* Append one record to this thread's buffer */
+static void record(uint32_t type, const void *ptr, const void *newptr,
+		   size_t size)
+{
+    rawtrace_rec_t *r;
+
+    if (rec_state != 1 || in_hook)
+	return;
+    in_hook = 1;
+    if (tbuf == NULL) {
+	tbuf = buf_new();
+	if (tbuf == NULL) {
+	    in_hook = 0;
+	    return;
+	}
+	pthread_setspecific(buf_key, tbuf);
+    }
+    r = &tbuf->recs[tbuf->count++];
+    r->type = type;
+    r->unused = 0;
+    r->ptr = (uint64_t) (uintptr_t) ptr;
+    r->newptr = (uint64_t) (uintptr_t) newptr;
+    r->size = size;
+    if (tbuf->count == BUF_RECS) {
+	buf_enqueue(tbuf);
+	tbuf = buf_new();
+	pthread_setspecific(buf_key, tbuf);
+    }
+    in_hook = 0;
+}
+
+__attribute__((destructor))
+static void rec_fini(void)
+{
+    if (rec_state != 1)
+	return;
+    rec_state = -1;
+    if (tbuf && tbuf->count > 0)
+	buf_enqueue(tbuf);
+    pthread_mutex_lock(&queue_lock);
+    flusher_exit = 1;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    pthread_join(flusher_tid, NULL);
+    close(out_fd);
+    out_fd = -1;
+}
+
+/***************** Interposed entry points *****************/
+
+void *malloc(size_t size)
+{
+    void *p;
+    ensure_init();
+    if (real_malloc == NULL)
+	return boot_alloc(size);
+    p = real_malloc(size);
+    if (p)
+	record(RAW_MALLOC, NULL, p, size);
+    return p;
+}
+
+void free(void *ptr)
+{
+    ensure_init();
+    if (ptr == NULL || is_boot_ptr(ptr))
+	return;
+    if (real_free == NULL)
+	return;
+    record(RAW_FREE, ptr, NULL, 0);
+    real_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+    ensure_init();
+    if (real_realloc == NULL || is_boot_ptr(ptr)) {
+	p = boot_alloc(size);
+	if (p && ptr)
+	    memcpy(p, ptr, size);
+	return p;
+    }
+    p = real_realloc(ptr, size);
+    if (p || size == 0)
+	record(RAW_REALLOC, ptr, p, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+    ensure_init();
+    /* dlsym itself calls calloc: serve from the bootstrap arena while
+       the real symbol is still being resolved (boot memory is zeroed) */
+    if (real_calloc == NULL) {
+	p = boot_alloc(nmemb * size);
+	if (p)
+	    memset(p, 0, nmemb * size);
+	return p;
+    }
+    p = real_calloc(nmemb, size);
+    if (p)
+	record(RAW_CALLOC, NULL, p, nmemb * size);
+    return p;
+}
@@ -0,0 +1,33 @@
+/*
+ * tracerec.h - raw allocation log format shared by the LD_PRELOAD
+ * recorder (tracerec.c) and the .rep converter (tracerec2rep.c).
+ *
+ * The shim appends fixed-width records of every malloc/calloc/free/
+ * realloc it sees; pointers are logged raw and only mapped to the
+ * dense block ids that .rep files need by the offline converter, so
+ * the recording hot path stays cheap.  Files start with an 8-byte
+ * magic and are written in host byte order.
+ */
+#ifndef __TRACEREC_H
+#define __TRACEREC_H
+
+#include <stdint.h>
+
+#define RAWTRACE_MAGIC "RAWREC1"
+#define RAWTRACE_MAGIC_LEN 8
+
+/* Record types */
+#define RAW_MALLOC  0
+#define RAW_FREE    1
+#define RAW_REALLOC 2
+#define RAW_CALLOC  3
+
+typedef struct {
+    uint32_t type;
+    uint32_t unused;
+    uint64_t ptr;      /* input pointer (free, realloc old block) */
+    uint64_t newptr;   /* returned pointer (malloc, calloc, realloc) */
+    uint64_t size;     /* requested bytes (nmemb * size for calloc) */
+} rawtrace_rec_t;
+
+#endif /* __TRACEREC_H */
@@ -0,0 +1,259 @@
+/*
+ * tracerec2rep.c - convert a raw allocation log recorded by the
+ * tracerec.so LD_PRELOAD shim into a .rep trace that mdriver replays.
+ *
+ * Usage: tracerec2rep logfile tracefile.rep [weight]
+ *
+ * Pointers in the log are mapped to the dense block ids .rep needs:
+ * every successful allocation gets a fresh id, reallocs keep their
+ * block's id, and frees of pointers the log never saw allocated (for
+ * example, blocks handed out before the shim loaded) are dropped.
+ * The header's data_bytes field is the peak of the sum of live
+ * request sizes, matching what eval_mm_util measures.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracerec.h"
+
+/* One emitted .rep operation */
+typedef struct {
+    char type;         /* 'a', 'r' or 'f' */
+    long index;
+    uint64_t size;
+} repop_t;
+
+/* Open-addressing map from live pointer to block id and size */
+typedef struct {
+    uint64_t ptr;      /* 0 empty, 1 tombstone */
+    long id;
+    uint64_t size;
+} slot_t;
+
+static slot_t *slots;
+static size_t nslots = 1024;   /* always a power of two */
+static size_t nfilled;
+static size_t nlive;
+
+static size_t ptr_hash(uint64_t ptr, size_t n)
+{
+    return (size_t) (((ptr >> 4) * 0x9E3779B97F4A7C15UL) >> 32) & (n - 1);
+}
+
+static slot_t *ptr_place(slot_t *tab, size_t n, uint64_t ptr)
+{
+    size_t i = ptr_hash(ptr, n);
+    slot_t *tombstone = NULL;
+
+    while (tab[i].ptr != 0) {
+	if (tab[i].ptr == 1) {
+	    if (tombstone == NULL)
+		tombstone = &tab[i];
+	} else if (tab[i].ptr == ptr) {
+	    return &tab[i];
+	}
+	i = (i + 1) & (n - 1);
+    }
+    return tombstone ? tombstone : &tab[i];
+}
+
+static void ptr_insert(uint64_t ptr, long id, uint64_t size)
+{
+    slot_t *s;
+
+    if (2 * (nfilled + 1) > nslots) {
+	size_t newn = 2 * nslots;
+	slot_t *tab = calloc(newn, sizeof(slot_t));
+	size_t i;
+	if (tab == NULL) {
+	    fprintf(stderr, "tracerec2rep: out of memory\n");
+	    exit(1);
+	}
+	for (i = 0; i < nslots; i++) {
+	    if (slots[i].ptr > 1)
+		*ptr_place(tab, newn, slots[i].ptr) = slots[i];
+	}
+	free(slots);
+	slots = tab;
+	nslots = newn;
+	nfilled = nlive;
+    }
+    s = ptr_place(slots, nslots, ptr);
+    if (s->ptr == 0)
+	nfilled++;
+    s->ptr = ptr;
+    s->id = id;
+    s->size = size;
+    nlive++;
+}
+
+/* Remove ptr from the map; returns false if it was not present */
+static int ptr_remove(uint64_t ptr, long *id, uint64_t *size)
+{
+    size_t i = ptr_hash(ptr, nslots);
+
+    while (slots[i].ptr != 0) {
+	if (slots[i].ptr == ptr) {
+	    *id = slots[i].id;
+	    *size = slots[i].size;
+	    slots[i].ptr = 1;
+	    nlive--;
+	    return 1;
+	}
+	i = (i + 1) & (nslots - 1);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *in, *out;
+    char magic[RAWTRACE_MAGIC_LEN];
+    rawtrace_rec_t rec;
+    repop_t *ops = NULL;
+    size_t nops = 0, capops = 0;
+    long next_id = 0;
+    uint64_t live_bytes = 0, peak_bytes = 0;
+    int weight = 1;
+    size_t i;
+
+    if (argc < 3 || argc > 4) {
+	fprintf(stderr, "Usage: %s logfile tracefile.rep [weight]\n", argv[0]);
+	return 1;
+    }
+    if (argc == 4)
+	weight = atoi(argv[3]);
+
+    if ((in = fopen(argv[1], "rb")) == NULL) {
+	fprintf(stderr, "tracerec2rep: could not open %s\n", argv[1]);
+	return 1;
+    }
+    if (fread(magic, 1, RAWTRACE_MAGIC_LEN, in) != RAWTRACE_MAGIC_LEN ||
+	memcmp(magic, RAWTRACE_MAGIC, RAWTRACE_MAGIC_LEN) != 0) {
+	fprintf(stderr, "tracerec2rep: %s is not a tracerec log\n", argv[1]);
+	fclose(in);
+	return 1;
+    }
+
+    slots = calloc(nslots, sizeof(slot_t));
+    if (slots == NULL) {
+	fprintf(stderr, "tracerec2rep: out of memory\n");
+	fclose(in);
+	return 1;
+    }
+
+    while (fread(&rec, sizeof(rec), 1, in) == 1) {
+	repop_t op;
+	long id;
+	uint64_t oldsize;
+
+	switch (rec.type) {
+	case RAW_MALLOC:
+	case RAW_CALLOC:
+	    if (rec.newptr == 0 || rec.size == 0)
+		continue;
+	    op.type = 'a';
+	    op.index = next_id++;
+	    op.size = rec.size;
+	    ptr_insert(rec.newptr, op.index, rec.size);
+	    live_bytes += rec.size;
+	    break;
+
+	case RAW_FREE:
+	    if (!ptr_remove(rec.ptr, &id, &oldsize))
+		continue;      /* allocated before the shim loaded */
+	    op.type = 'f';
+	    op.index = id;
+	    op.size = 0;
+	    live_bytes -= oldsize;
+	    break;
+
+	case RAW_REALLOC:
+	    if (rec.ptr != 0 && ptr_remove(rec.ptr, &id, &oldsize))
+		live_bytes -= oldsize;
+	    else if (rec.size == 0)
+		continue;      /* realloc(NULL, 0) or unknown block */
+	    else
+		id = -1;
+	    if (rec.size == 0) {
+		/* realloc(p, 0) frees the block */
+		op.type = 'f';
+		op.index = id;
+		op.size = 0;
+	    } else {
+		/* unknown old blocks become plain allocations */
+		op.type = id >= 0 ? 'r' : 'a';
+		op.index = id >= 0 ? id : next_id++;
+		op.size = rec.size;
+		ptr_insert(rec.newptr, op.index, rec.size);
+		live_bytes += rec.size;
+	    }
+	    break;
+
+	default:
+	    fprintf(stderr, "tracerec2rep: bogus record type %u in %s\n",
+		    rec.type, argv[1]);
+	    fclose(in);
+	    return 1;
+	}
+
+	if (live_bytes > peak_bytes)
+	    peak_bytes = live_bytes;
+	if (nops == capops) {
+	    capops = capops ? 2 * capops : 4096;
+	    ops = realloc(ops, capops * sizeof(repop_t));
+	    if (ops == NULL) {
+		fprintf(stderr, "tracerec2rep: out of memory\n");
+		return 1;
+	    }
+	}
+	ops[nops++] = op;
+    }
+    fclose(in);
+
+    if (next_id == 0) {
+	fprintf(stderr, "tracerec2rep: %s contains no allocations\n", argv[1]);
+	return 1;
+    }
+
+    /* mdriver replays with an empty heap, so free anything still live
+       to keep the trace reusable across repetitions */
+    for (i = 0; i < nslots; i++) {
+	if (slots[i].ptr > 1) {
+	    if (nops == capops) {
+		capops = 2 * capops;
+		ops = realloc(ops, capops * sizeof(repop_t));
+		if (ops == NULL) {
+		    fprintf(stderr, "tracerec2rep: out of memory\n");
+		    return 1;
+		}
+	    }
+	    ops[nops].type = 'f';
+	    ops[nops].index = slots[i].id;
+	    ops[nops].size = 0;
+	    nops++;
+	}
+    }
+
+    if ((out = fopen(argv[2], "w")) == NULL) {
+	fprintf(stderr, "tracerec2rep: could not create %s\n", argv[2]);
+	return 1;
+    }
+    fprintf(out, "%d\n%ld\n%zu\n%lu\n", weight, next_id, nops,
+	    (unsigned long) peak_bytes);
+    for (i = 0; i < nops; i++) {
+	if (ops[i].type == 'f')
+	    fprintf(out, "f %ld\n", ops[i].index);
+	else
+	    fprintf(out, "%c %ld %lu\n", ops[i].type, ops[i].index,
+		    (unsigned long) ops[i].size);
+    }
+    fclose(out);
+
+    printf("%s -> %s (%ld ids, %zu ops, %lu peak bytes)\n",
+	   argv[1], argv[2], next_id, nops, (unsigned long) peak_bytes);
+    free(ops);
+    free(slots);
+    return 0;
+}